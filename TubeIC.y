@@ -1,15 +1,38 @@
 %{
+#include <chrono>
 #include <iostream>
 #include <stdio.h>
 #include <string>
 #include <vector>
 
 #include "inst.h"
+#include "cache.h"
+#include "estimate.h"
 #include "hardware.h"
+#include "module.h"
+#include "source.h"
+#include "scheduler.h"
+#include "server.h"
 
 extern int line_num;
+extern std::string source_file;
 extern int yylex();
 extern cHardware * main_hardware;
+extern std::vector<std::string> schedule_files;
+extern std::vector<int> schedule_priorities;
+extern int schedule_quantum;
+extern int schedule_threads;
+extern bool schedule_by_priority;
+extern bool server_mode;
+extern bool estimate_only;
+extern bool load_stats;
+extern std::string cache_dir;
+extern long long cache_max_bytes;
+
+// Instructions and their arguments are built in the program's arena and freed along with it.
+template <typename T, typename... ARGS> T * Build(ARGS... args) {
+  return main_hardware->GetArena().New<T>(args...);
+}
 
 void yyerror(std::string err_string) {
   // std::cout << "ERROR(line " << line_num << "): " << err_string << std::endl;
@@ -20,7 +43,7 @@ void yyerror(std::string err_string) {
 
 %union {
   int int_val;
-  float float_val;
+  double float_val;   // Converted to tValue once the argument is built.
   char * lexeme;
   cInst_Base * inst_ptr;
   cInstArg_Base * arg_ptr;
@@ -28,18 +51,20 @@ void yyerror(std::string err_string) {
 
 %token INST_VAL_COPY INST_ADD INST_SUB INST_MULT INST_DIV INST_MOD
 %token INST_TEST_LESS INST_TEST_GTR INST_TEST_EQU INST_TEST_NEQU INST_TEST_GTE INST_TEST_LTE
-%token INST_JUMP INST_JUMP_IF_0 INST_JUMP_IF_N0
+%token INST_JUMP INST_JUMP_IF_0 INST_JUMP_IF_N0 INST_CALL INST_RET
 %token INST_NOP INST_RANDOM INST_OUT_INT INST_OUT_FLOAT INST_OUT_CHAR INST_PUSH INST_POP
 
 %token INST_AR_GET_IDX INST_AR_SET_IDX INST_AR_GET_SIZ INST_AR_SET_SIZ INST_AR_COPY
 %token INST_AR_PUSH INST_AR_POP
+%token INST_AR_ADD INST_AR_SUB INST_AR_MULT INST_AR_FILL INST_AR_SUM INST_AR_MIN INST_AR_MAX
+%token INST_AR_DOT INST_AR_COPY_RANGE INST_AR_SORT
 %token ENDLINE 
 %token <int_val> ARG_INT ARG_SCALAR ARG_CHAR ARG_ARRAY
 %token <float_val> ARG_FLOAT
-%token <lexeme> ARG_LABEL
+%token <lexeme> ARG_LABEL MODULE_IMPORT
 
 %type <inst_ptr> statement
-%type <arg_ptr> arg_var arg_arr arg_const arg_any
+%type <arg_ptr> arg_var arg_arr arg_const arg_any arg_arr_any
 
 %%
 
@@ -54,38 +79,53 @@ statement_list:	{ ; }
                   main_hardware->AddLabel($2);
 		  if ($4 != NULL) main_hardware->AddInst($4);
 		}
+	|	statement_list MODULE_IMPORT ENDLINE {
+		  main_hardware->AddImport(ResolveModulePath(source_file, $2));
+		}
 	;
 
 statement:   { $$ = NULL; }
-  | INST_VAL_COPY   arg_any arg_var         { $$ = new cInst_VAL_COPY(line_num,$2,$3); }
-  | INST_ADD        arg_any arg_any arg_var { $$ = new cInst_ADD(line_num,$2,$3,$4); }
-  | INST_SUB        arg_any arg_any arg_var { $$ = new cInst_SUB(line_num,$2,$3,$4); }
-  | INST_MULT       arg_any arg_any arg_var { $$ = new cInst_MULT(line_num,$2,$3,$4); }
-  | INST_DIV        arg_any arg_any arg_var { $$ = new cInst_DIV(line_num,$2,$3,$4); }
-  | INST_MOD        arg_any arg_any arg_var { $$ = new cInst_MOD(line_num,$2,$3,$4); }
-  | INST_TEST_LESS  arg_any arg_any arg_var { $$ = new cInst_TEST_LESS(line_num,$2,$3,$4); }
-  | INST_TEST_GTR   arg_any arg_any arg_var { $$ = new cInst_TEST_GTR(line_num,$2,$3,$4); }
-  | INST_TEST_EQU   arg_any arg_any arg_var { $$ = new cInst_TEST_EQU(line_num,$2,$3,$4); }
-  | INST_TEST_NEQU  arg_any arg_any arg_var { $$ = new cInst_TEST_NEQU(line_num,$2,$3,$4); }
-  | INST_TEST_GTE   arg_any arg_any arg_var { $$ = new cInst_TEST_GTE(line_num,$2,$3,$4); }
-  | INST_TEST_LTE   arg_any arg_any arg_var { $$ = new cInst_TEST_LTE(line_num,$2,$3,$4); }
-  | INST_JUMP       arg_any                 { $$ = new cInst_JUMP(line_num,$2); }
-  | INST_JUMP_IF_0  arg_any arg_any         { $$ = new cInst_JUMP_IF_0(line_num,$2,$3); }
-  | INST_JUMP_IF_N0 arg_any arg_any         { $$ = new cInst_JUMP_IF_N0(line_num,$2,$3); }
-  | INST_NOP                                { $$ = new cInst_NOP(line_num); }
-  | INST_RANDOM     arg_any arg_var         { $$ = new cInst_RANDOM(line_num,$2,$3); }
-  | INST_OUT_INT    arg_any                 { $$ = new cInst_OUT_INT(line_num,$2); }
-  | INST_OUT_FLOAT  arg_any                 { $$ = new cInst_OUT_FLOAT(line_num,$2); }
-  | INST_OUT_CHAR   arg_any                 { $$ = new cInst_OUT_CHAR(line_num,$2); }
-  | INST_PUSH       arg_any                 { $$ = new cInst_PUSH_NUM(line_num,$2); }
-  | INST_POP        arg_var                 { $$ = new cInst_POP_NUM(line_num,$2); }
-  | INST_AR_GET_IDX arg_arr arg_any arg_var { $$ = new cInst_AR_GET_IDX(line_num,$2,$3,$4); }
-  | INST_AR_SET_IDX arg_arr arg_any arg_any { $$ = new cInst_AR_SET_IDX(line_num,$2,$3,$4); }
-  | INST_AR_GET_SIZ arg_arr arg_var         { $$ = new cInst_AR_GET_SIZ(line_num,$2,$3); }
-  | INST_AR_SET_SIZ arg_arr arg_any         { $$ = new cInst_AR_SET_SIZ(line_num,$2,$3); }
-  | INST_AR_COPY    arg_arr arg_arr         { $$ = new cInst_AR_COPY(line_num,$2,$3); }
-  | INST_AR_PUSH    arg_arr                 { $$ = new cInst_PUSH_ARRAY(line_num,$2); }
-  | INST_AR_POP     arg_arr                 { $$ = new cInst_POP_ARRAY(line_num,$2); }
+  | INST_VAL_COPY   arg_any arg_var         { $$ = Build<cInst_VAL_COPY>(line_num,$2,$3); }
+  | INST_ADD        arg_any arg_any arg_var { $$ = Build<cInst_ADD>(line_num,$2,$3,$4); }
+  | INST_SUB        arg_any arg_any arg_var { $$ = Build<cInst_SUB>(line_num,$2,$3,$4); }
+  | INST_MULT       arg_any arg_any arg_var { $$ = Build<cInst_MULT>(line_num,$2,$3,$4); }
+  | INST_DIV        arg_any arg_any arg_var { $$ = Build<cInst_DIV>(line_num,$2,$3,$4); }
+  | INST_MOD        arg_any arg_any arg_var { $$ = Build<cInst_MOD>(line_num,$2,$3,$4); }
+  | INST_TEST_LESS  arg_any arg_any arg_var { $$ = Build<cInst_TEST_LESS>(line_num,$2,$3,$4); }
+  | INST_TEST_GTR   arg_any arg_any arg_var { $$ = Build<cInst_TEST_GTR>(line_num,$2,$3,$4); }
+  | INST_TEST_EQU   arg_any arg_any arg_var { $$ = Build<cInst_TEST_EQU>(line_num,$2,$3,$4); }
+  | INST_TEST_NEQU  arg_any arg_any arg_var { $$ = Build<cInst_TEST_NEQU>(line_num,$2,$3,$4); }
+  | INST_TEST_GTE   arg_any arg_any arg_var { $$ = Build<cInst_TEST_GTE>(line_num,$2,$3,$4); }
+  | INST_TEST_LTE   arg_any arg_any arg_var { $$ = Build<cInst_TEST_LTE>(line_num,$2,$3,$4); }
+  | INST_JUMP       arg_any                 { $$ = Build<cInst_JUMP>(line_num,$2); }
+  | INST_JUMP_IF_0  arg_any arg_any         { $$ = Build<cInst_JUMP_IF_0>(line_num,$2,$3); }
+  | INST_JUMP_IF_N0 arg_any arg_any         { $$ = Build<cInst_JUMP_IF_N0>(line_num,$2,$3); }
+  | INST_CALL       arg_any                 { $$ = Build<cInst_CALL>(line_num,$2); }
+  | INST_RET                                { $$ = Build<cInst_RET>(line_num); }
+  | INST_NOP                                { $$ = Build<cInst_NOP>(line_num); }
+  | INST_RANDOM     arg_any arg_var         { $$ = Build<cInst_RANDOM>(line_num,$2,$3); }
+  | INST_OUT_INT    arg_any                 { $$ = Build<cInst_OUT_INT>(line_num,$2); }
+  | INST_OUT_FLOAT  arg_any                 { $$ = Build<cInst_OUT_FLOAT>(line_num,$2); }
+  | INST_OUT_CHAR   arg_any                 { $$ = Build<cInst_OUT_CHAR>(line_num,$2); }
+  | INST_PUSH       arg_any                 { $$ = Build<cInst_PUSH_NUM>(line_num,$2); }
+  | INST_POP        arg_var                 { $$ = Build<cInst_POP_NUM>(line_num,$2); }
+  | INST_AR_GET_IDX arg_arr arg_any arg_var { $$ = Build<cInst_AR_GET_IDX>(line_num,$2,$3,$4); }
+  | INST_AR_SET_IDX arg_arr arg_any arg_any { $$ = Build<cInst_AR_SET_IDX>(line_num,$2,$3,$4); }
+  | INST_AR_GET_SIZ arg_arr arg_var         { $$ = Build<cInst_AR_GET_SIZ>(line_num,$2,$3); }
+  | INST_AR_SET_SIZ arg_arr arg_any         { $$ = Build<cInst_AR_SET_SIZ>(line_num,$2,$3); }
+  | INST_AR_COPY    arg_arr arg_arr         { $$ = Build<cInst_AR_COPY>(line_num,$2,$3); }
+  | INST_AR_PUSH    arg_arr                 { $$ = Build<cInst_PUSH_ARRAY>(line_num,$2); }
+  | INST_AR_POP     arg_arr                 { $$ = Build<cInst_POP_ARRAY>(line_num,$2); }
+  | INST_AR_ADD     arg_arr arg_arr_any arg_arr { $$ = Build<cInst_AR_ADD>(line_num,$2,$3,$4); }
+  | INST_AR_SUB     arg_arr arg_arr_any arg_arr { $$ = Build<cInst_AR_SUB>(line_num,$2,$3,$4); }
+  | INST_AR_MULT    arg_arr arg_arr_any arg_arr { $$ = Build<cInst_AR_MULT>(line_num,$2,$3,$4); }
+  | INST_AR_FILL    arg_arr arg_any         { $$ = Build<cInst_AR_FILL>(line_num,$2,$3); }
+  | INST_AR_SUM     arg_arr arg_var         { $$ = Build<cInst_AR_SUM>(line_num,$2,$3); }
+  | INST_AR_MIN     arg_arr arg_var         { $$ = Build<cInst_AR_MIN>(line_num,$2,$3); }
+  | INST_AR_MAX     arg_arr arg_var         { $$ = Build<cInst_AR_MAX>(line_num,$2,$3); }
+  | INST_AR_DOT     arg_arr arg_arr arg_var { $$ = Build<cInst_AR_DOT>(line_num,$2,$3,$4); }
+  | INST_AR_COPY_RANGE arg_arr arg_any arg_arr { $$ = Build<cInst_AR_COPY_RANGE>(line_num,$2,$3,$4); }
+  | INST_AR_SORT    arg_arr                 { $$ = Build<cInst_AR_SORT>(line_num,$2); }
   | ARG_LABEL {
        std::string err = "Unknown instruction '";
        err += $1;
@@ -99,39 +139,110 @@ arg_any:  arg_var { $$ = $1; }
           | arg_const { $$ = $1; }
           ;
 
-arg_const: ARG_FLOAT { $$ = new cInstArg_Float($1); }
-           | ARG_CHAR { $$ = new cInstArg_Float($1); }
-           | ARG_LABEL { $$ = new cInstArg_Label($1); }
+arg_arr_any:  arg_arr { $$ = $1; }
+          | arg_any { $$ = $1; }
+          ;
+
+arg_const: ARG_FLOAT { $$ = Build<cInstArg_Float>($1); }
+           | ARG_CHAR { $$ = Build<cInstArg_Float>($1); }
+           | ARG_LABEL { $$ = Build<cInstArg_Label>($1); }
            ;
 
-arg_var:  ARG_SCALAR { $$ = new cInstArg_Var($1); }
+arg_var:  ARG_SCALAR { $$ = Build<cInstArg_Var>($1); }
           ;
 
-arg_arr:  ARG_ARRAY { $$ = new cInstArg_Array($1); }
+arg_arr:  ARG_ARRAY { $$ = Build<cInstArg_Array>($1); }
           ;
 
 %%
 void LexMain(int argc, char * argv[]);
+void LexReadFile(const std::string & filename);
 void LexReadString(const std::string & in_string);
 
+// Parse a module on its own, for the linker to compile (see module.h).
+void ParseModule(cHardware & hardware, const std::string & filename)
+{
+  cHardware * outer_hardware = main_hardware;
+  main_hardware = &hardware;
+  LexReadFile(filename);
+  yyparse();
+  main_hardware = outer_hardware;
+}
+
+int program_lines = 0;   // Lines in the program parsed most recently, not counting modules.
+
+// Parse the program the lexer has been pointed at, then link in any modules it imports.
+void ParseProgram()
+{
+  yyparse();
+  program_lines = line_num - 1;
+  LinkModules(*main_hardware, ParseModule, "TubeIC");
+}
+
+// Parse a program sent to the server into the hardware that will run it.
+void LoadSource(cHardware & hardware, const std::string & source)
+{
+  main_hardware = &hardware;
+  line_num = 1;
+  LexReadString(source);
+  ParseProgram();
+}
+
+// Parse a whole program file into hardware, linking in its modules, for the scheduler.
+void LoadProgramFile(cHardware & hardware, const std::string & filename)
+{
+  cHardware * outer_hardware = main_hardware;
+  main_hardware = &hardware;
+  LexReadFile(filename);
+  ParseProgram();
+  main_hardware = outer_hardware;
+}
+
 #ifndef EMSCRIPTEN
 int main(int argc, char * argv[])
 {
+  const std::chrono::steady_clock::time_point load_start = std::chrono::steady_clock::now();
   main_hardware = new cHardware();
   LexMain(argc, argv);
-  yyparse();
-
-  main_hardware->Run();
-
-  return 0;
+  cResultCache * cache = (cache_dir.size() > 0) ? new cResultCache(cache_dir, cache_max_bytes) : NULL;
+  if (server_mode) return RunServer(*main_hardware, LoadSource, cache, "TubeIC");
+  if (schedule_files.size() > 0) {
+    return RunScheduled(*main_hardware, LoadProgramFile, cache, "TubeIC", schedule_files, schedule_priorities,
+                        schedule_quantum, schedule_by_priority ? SCHEDULE_PRIORITY : SCHEDULE_ROUND_ROBIN,
+                        schedule_threads);
+  }
+  ParseProgram();
+  if (load_stats) {
+    const std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start;
+    PrintLoadStats(std::cerr, program_lines, load_time.count());
+  }
+
+  if (estimate_only) {
+    cCostEstimate(*main_hardware).Print(std::cout);
+    return 0;
+  }
+
+  return RunWithCache(*main_hardware, cache, "TubeIC").GetExitCode();
 }
 #endif
 
 bool ParseString(const std::string & in_string)
 {
+  line_num = 1;
   LexReadString(in_string);
-  yyparse();
+  ParseProgram();
   // yy_delete_buffer(YY_CURRENT_BUFFER);
 
   return true;
 }
+
+// Parse lines from the middle of a program, the first being line first_line, into the hardware
+// it is loaded in (see cHardware::BeginReplace()); nothing is linked.
+bool ParseLines(const std::string & in_string, int first_line)
+{
+  line_num = first_line;
+  LexReadString(in_string);
+  yyparse();
+
+  return true;
+}
@@ -0,0 +1,87 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Allocates many small objects out of large blocks, freeing them all at once when the arena is
+// cleared or destroyed.  Objects are destroyed in the reverse of the order they were built.
+class cArena {
+private:
+  static const size_t BLOCK_SIZE = 16384;
+  static const size_t ALIGN = alignof(std::max_align_t);
+
+  // Stored just before each object, so that it can be destroyed along with the arena.
+  struct cRecord {
+    void (*destroy)(void *);
+    cRecord * prev;
+  };
+  static const size_t RECORD_SIZE = (sizeof(cRecord) + ALIGN - 1) & ~(ALIGN - 1);
+
+  std::vector<char *> blocks;
+  char * current;       // Block that small objects are currently taken from.
+  size_t block_used;    // Bytes used in the current block.
+  size_t total_bytes;   // Bytes in all blocks.
+  cRecord * last;       // Most recently built object.
+
+  template <typename T> static void Destroy(void * ptr) { static_cast<T *>(ptr)->~T(); }
+
+  void * Allocate(size_t size) {
+    size = (size + ALIGN - 1) & ~(ALIGN - 1);
+    if (size > BLOCK_SIZE / 4) {   // Large requests get a block of their own.
+      blocks.push_back(new char[size]);
+      total_bytes += size;
+      return blocks.back();
+    }
+    if (current == NULL || block_used + size > BLOCK_SIZE) {
+      current = new char[BLOCK_SIZE];
+      blocks.push_back(current);
+      block_used = 0;
+      total_bytes += BLOCK_SIZE;
+    }
+    void * out = current + block_used;
+    block_used += size;
+    return out;
+  }
+
+public:
+  cArena() : current(NULL), block_used(0), total_bytes(0), last(NULL) { ; }
+  cArena(const cArena &) = delete;
+  cArena & operator=(const cArena &) = delete;
+  ~cArena() { Clear(); }
+
+  template <typename T, typename... ARGS> T * New(ARGS &&... args) {
+    cRecord * record = static_cast<cRecord *>(Allocate(RECORD_SIZE + sizeof(T)));
+    T * out = new (reinterpret_cast<char *>(record) + RECORD_SIZE) T(std::forward<ARGS>(args)...);
+    record->destroy = &Destroy<T>;
+    record->prev = last;
+    last = record;
+    return out;
+  }
+
+  char * NewString(const char * in) {
+    const size_t size = strlen(in) + 1;
+    char * out = static_cast<char *>(Allocate(size));
+    memcpy(out, in, size);
+    return out;
+  }
+
+  void Clear() {
+    for (cRecord * record = last; record != NULL; record = record->prev) {
+      record->destroy(reinterpret_cast<char *>(record) + RECORD_SIZE);
+    }
+    for (int i = 0; i < (int) blocks.size(); i++) delete [] blocks[i];
+    blocks.clear();
+    current = NULL;
+    block_used = 0;
+    total_bytes = 0;
+    last = NULL;
+  }
+
+  size_t GetBytes() const { return total_bytes; }
+};
+
+#endif
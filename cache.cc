@@ -0,0 +1,151 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+const char * const cResultCache::VERSION = "tube-result-1";
+
+namespace {
+  const char result_magic[] = "TUBERES1";
+
+  unsigned long long HashString(unsigned long long hash, const std::string & in) {
+    for (int i = 0; i < (int) in.size(); i++) {
+      hash ^= (unsigned char) in[i];
+      hash *= 0x100000001b3ULL;
+    }
+    return hash;
+  }
+
+  struct cCacheFile {
+    std::string path;
+    long long size;
+    time_t used;
+    bool operator<(const cCacheFile & other) const { return used < other.used; }
+  };
+}
+
+
+cResultCache::cResultCache(const std::string & _dir, long long _max_bytes)
+  : dir(_dir), max_bytes(_max_bytes)
+{
+  mkdir(dir.c_str(), 0755);  // Fine if it already exists.
+}
+
+std::string cResultCache::GetPath(unsigned long long key) const
+{
+  char name[17];
+  snprintf(name, sizeof(name), "%016llx", key);
+  return dir + "/" + name + ".res";
+}
+
+unsigned long long cResultCache::GetKey(cHardware & hardware, const std::string & engine) const
+{
+  unsigned long long key = 0xcbf29ce484222325ULL;
+  key = HashString(key, VERSION);
+  key = HashString(key, engine);
+  key = HashString(key, TUBE_VALUE_NAME);
+  std::stringstream run_hash;
+  run_hash << hardware.GetRunHash();
+  return HashString(key, run_hash.str());
+}
+
+bool cResultCache::Lookup(unsigned long long key, cRunResult & result) const
+{
+  const std::string path = GetPath(key);
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file) return false;
+
+  char magic[8];
+  long long output_size = -1;
+  file.read(magic, 8);
+  file >> result.exe_count >> result.halt_type >> output_size;
+  if (!file || std::string(magic, 8) != std::string(result_magic, 8) || output_size < 0) return false;
+  file.get();  // Newline before the output.
+
+  result.output.assign(output_size, '\0');
+  if (output_size > 0 && !file.read(&result.output[0], output_size)) return false;
+
+  utime(path.c_str(), NULL);  // Mark as recently used.
+  return true;
+}
+
+void cResultCache::Store(unsigned long long key, const cRunResult & result)
+{
+  // Write under a temporary name first so that other processes never see a partial result.
+  const std::string path = GetPath(key);
+  std::stringstream temp_path;
+  temp_path << path << ".tmp" << getpid();
+  {
+    std::ofstream file(temp_path.str().c_str(), std::ios::binary);
+    file.write(result_magic, 8);
+    file << result.exe_count << " " << result.halt_type << " " << result.output.size() << '\n';
+    file.write(result.output.c_str(), result.output.size());
+    if (!file) {
+      remove(temp_path.str().c_str());
+      return;
+    }
+  }
+  rename(temp_path.str().c_str(), path.c_str());
+
+  if (max_bytes >= 0) Evict();
+}
+
+// Remove the least recently used results until the cache fits in max_bytes.
+void cResultCache::Evict()
+{
+  DIR * dir_handle = opendir(dir.c_str());
+  if (dir_handle == NULL) return;
+
+  std::vector<cCacheFile> files;
+  long long total_size = 0;
+  struct dirent * entry;
+  while ((entry = readdir(dir_handle)) != NULL) {
+    const std::string name = entry->d_name;
+    if (name.size() < 4 || name.compare(name.size() - 4, 4, ".res") != 0) continue;
+    struct stat info;
+    const std::string path = dir + "/" + name;
+    if (stat(path.c_str(), &info) != 0) continue;
+    cCacheFile file = { path, (long long) info.st_size, info.st_mtime };
+    files.push_back(file);
+    total_size += file.size;
+  }
+  closedir(dir_handle);
+
+  if (total_size <= max_bytes) return;
+  std::sort(files.begin(), files.end());
+  for (int i = 0; i < (int) files.size() && total_size > max_bytes; i++) {
+    if (remove(files[i].path.c_str()) == 0) total_size -= files[i].size;
+  }
+}
+
+
+cRunResult RunWithCache(cHardware & hardware, cResultCache * cache, const std::string & engine)
+{
+  cRunResult result;
+  const bool use_cache = (cache != NULL && hardware.IsRepeatable());
+  const unsigned long long key = use_cache ? cache->GetKey(hardware, engine) : 0;
+
+  if (use_cache && cache->Lookup(key, result)) {
+    hardware << result.output;
+    return result;
+  }
+
+  // Anything printed while loading the program is not part of the run itself.
+  const size_t output_start = hardware.GetMessages().size();
+  hardware.Run();
+  result.output = hardware.GetMessages().substr(output_start);
+  result.exe_count = hardware.GetExeCount();
+  result.halt_type = hardware.GetHaltType();
+
+  // Hitting the wall-clock limit depends on the machine, not just on the program.
+  if (use_cache && result.halt_type != HALT_WALL_TIME) cache->Store(key, result);
+  return result;
+}
@@ -0,0 +1,44 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <string>
+
+#include "hardware.h"
+
+// The observable result of running a program.
+struct cRunResult {
+  std::string output;
+  int exe_count;
+  int halt_type;
+
+  int GetExitCode() const { return cHardware::ExitCodeFor(halt_type); }
+};
+
+// Results of earlier runs, stored one file per run in a directory and named by a hash of the
+// program, its starting state, seed and limits, and the engine that ran it.  Each hit marks its
+// file as recently used; once the directory grows past max_bytes, the least recently used
+// results are removed.
+class cResultCache {
+private:
+  static const char * const VERSION;   // Changes whenever results from older builds may differ.
+
+  std::string dir;
+  long long max_bytes;   // Negative for no limit.
+
+  std::string GetPath(unsigned long long key) const;
+  void Evict();
+
+public:
+  cResultCache(const std::string & _dir, long long _max_bytes=-1);
+  ~cResultCache() { ; }
+
+  unsigned long long GetKey(cHardware & hardware, const std::string & engine) const;
+  bool Lookup(unsigned long long key, cRunResult & result) const;
+  void Store(unsigned long long key, const cRunResult & result);
+};
+
+// Run hardware to the end, printing as it goes, unless cache already has the result, in which
+// case the stored output is printed instead.  cache may be NULL.
+cRunResult RunWithCache(cHardware & hardware, cResultCache * cache, const std::string & engine);
+
+#endif
@@ -0,0 +1,756 @@
+#include "estimate.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <string>
+
+namespace {
+  // How an instruction passes control on.
+  enum Flow { FLOW_NEXT=0, FLOW_JUMP, FLOW_BRANCH, FLOW_CALL, FLOW_RET, FLOW_LOST };
+
+  // Where PathCost() goes from an edge.
+  enum Edge { EDGE_FOLLOW=0, EDGE_END, EDGE_NONE };
+
+  cInst_Base * Unwrap(cInst_Base * inst)
+  {
+    cInst_BREAK * trap = dynamic_cast<cInst_BREAK *>(inst);
+    return trap ? trap->GetOriginal() : inst;
+  }
+
+  cInstArg_Base * GetArg(cInst_Base * inst, int id)
+  {
+    switch (id) {
+    case 1: return inst->GetArg1();
+    case 2: return inst->GetArg2();
+    case 3: return inst->GetArg3();
+    case 4: return inst->GetArg4();
+    }
+    return NULL;
+  }
+
+  // Which argument an instruction places a value in; 0 for none, -1 if not known.
+  int WrittenArg(const std::string & name)
+  {
+    static const char * const no_value[] = {
+      "jump", "jump_if_0", "jump_if_n0", "call", "ret", "nop", "out_int", "out_float", "out_char",
+      "push", "ar_push", "ar_pop", "ar_set_idx", "ar_set_siz", "ar_copy", "ar_add", "ar_sub",
+      "ar_mult", "ar_fill", "ar_copy_range", "ar_sort", "store", "mem_copy", "mem_fill",
+      "mem_block_copy", "debug_status", "end"
+    };
+
+    if (name == "pop") return 1;
+    if (name == "val_copy" || name == "random" || name == "load" || name == "ar_get_siz" ||
+        name == "ar_sum" || name == "ar_min" || name == "ar_max") return 2;
+    if (name == "add" || name == "sub" || name == "mult" || name == "div" || name == "mod" ||
+        name.compare(0, 5, "test_") == 0 || name == "ar_get_idx" || name == "ar_dot" ||
+        name == "mem_sum") return 3;
+    if (name == "mem_compare") return 4;
+    for (int i = 0; i < (int) (sizeof(no_value) / sizeof(no_value[0])); i++) {
+      if (name == no_value[i]) return 0;
+    }
+    return -1;
+  }
+
+  // Registers and scalars share storage, so either gives the ID of what it refers to; -1 if
+  // the argument is neither.
+  int VarID(cInstArg_Base * arg)
+  {
+    if (cInstArg_Reg * reg = dynamic_cast<cInstArg_Reg *>(arg)) return reg->GetID();
+    if (cInstArg_Var * var = dynamic_cast<cInstArg_Var *>(arg)) return var->GetID();
+    return -1;
+  }
+
+  bool IsConst(cInstArg_Base * arg) { return dynamic_cast<cInstArg_Float *>(arg) != NULL; }
+
+  // Result of test_<op> on a and b.
+  bool Compare(const std::string & op, double a, double b)
+  {
+    if (op == "less") return a < b;
+    if (op == "gtr") return a > b;
+    if (op == "equ") return a == b;
+    if (op == "nequ") return a != b;
+    if (op == "gte") return a >= b;
+    return a <= b;  // lte
+  }
+
+  // The test that gives the same result with its arguments swapped.
+  std::string Mirror(const std::string & op)
+  {
+    if (op == "less") return "gtr";
+    if (op == "gtr") return "less";
+    if (op == "gte") return "lte";
+    if (op == "lte") return "gte";
+    return op;
+  }
+
+  long long SafeAdd(long long a, long long b)
+  {
+    if (a == cCostEstimate::UNBOUNDED || b == cCostEstimate::UNBOUNDED) return cCostEstimate::UNBOUNDED;
+    if (a > LLONG_MAX - b) return cCostEstimate::UNBOUNDED;
+    return a + b;
+  }
+
+  void PrintCycles(std::ostream & out, long long min, long long max)
+  {
+    if (max == cCostEstimate::UNBOUNDED) out << "at least " << min;
+    else if (min == max) out << min;
+    else out << min << " to " << max;
+  }
+}
+
+
+cCostEstimate::cCostEstimate(cHardware & _hardware)
+  : hardware(_hardware), irreducible(false)
+{
+  FindBlocks();
+  FindDominators();
+  FindLoops();
+
+  const cRange empty = { 0, 0, true };
+  const cRange open = { 0, UNBOUNDED, true };
+  total = (blocks.size() > 0) ? PathCost(0, -1, false) : empty;
+  if (!total.valid) total = open;
+  for (int i = 0; i < (int) loops.size(); i++) LoopCost(i);   // Including those never reached.
+}
+
+cCostEstimate::cRange cCostEstimate::Add(cRange a, cRange b)
+{
+  cRange out = { SafeAdd(a.min, b.min), SafeAdd(a.max, b.max), a.valid && b.valid };
+  if (out.min == UNBOUNDED) out.min = LLONG_MAX;
+  return out;
+}
+
+cCostEstimate::cRange cCostEstimate::Merge(cRange a, cRange b)
+{
+  if (!a.valid) return b;
+  if (!b.valid) return a;
+  cRange out = { std::min(a.min, b.min), std::max(a.max, b.max), true };
+  if (a.max == UNBOUNDED || b.max == UNBOUNDED) out.max = UNBOUNDED;
+  return out;
+}
+
+long long cCostEstimate::Times(long long cost, long long count)
+{
+  if (cost == UNBOUNDED) return UNBOUNDED;
+  if (count > 0 && cost > LLONG_MAX / count) return UNBOUNDED;
+  return cost * count;
+}
+
+// Instruction a jump argument leads to; -1 if it leaves the program, -2 if not known statically.
+int cCostEstimate::Target(cInstArg_Base * arg)
+{
+  int target = -1;
+  if (cInstArg_Label * label = dynamic_cast<cInstArg_Label *>(arg)) {
+    const std::map<std::string,int> & label_map = hardware.GetLabelMap();
+    std::map<std::string,int>::const_iterator it = label_map.find(label->GetLabel());
+    if (it == label_map.end()) return -1;  // Halts with an error.
+    target = it->second;
+  }
+  else if (IsConst(arg)) target = arg->AsInt();
+  else return -2;
+
+  return (target >= 0 && target < hardware.GetNumInsts()) ? target : -1;
+}
+
+void cCostEstimate::FindBlocks()
+{
+  const int num_insts = hardware.GetNumInsts();
+  std::vector<int> flow(num_insts, FLOW_NEXT);
+  std::vector<int> target(num_insts, -1);
+  std::vector<bool> leader(num_insts + 1, false);
+  leader[0] = true;
+
+  for (int i = 0; i < num_insts; i++) {
+    cInst_Base * inst = Unwrap(hardware.GetInst(i));
+    const std::string name = inst->GetName();
+    if (name == "jump" || name == "call") {
+      target[i] = Target(inst->GetArg1());
+      flow[i] = (name == "jump" || target[i] == -1) ? FLOW_JUMP : FLOW_CALL;
+    }
+    else if (name == "jump_if_0" || name == "jump_if_n0") {
+      target[i] = Target(inst->GetArg2());
+      flow[i] = FLOW_BRANCH;
+    }
+    else if (name == "ret") flow[i] = FLOW_RET;
+    else if (name == "end") flow[i] = FLOW_JUMP;   // To target -1, the end of the program.
+    else {
+      const int written = WrittenArg(name);
+      if (written > 0 && dynamic_cast<cInstArg_IP *>(GetArg(inst, written))) flow[i] = FLOW_LOST;
+    }
+    if (target[i] == -2) flow[i] = FLOW_LOST;
+
+    if (flow[i] != FLOW_NEXT) leader[i + 1] = true;
+    if (target[i] >= 0) leader[target[i]] = true;
+  }
+
+  block_of.resize(num_insts);
+  for (int i = 0; i < num_insts; i++) {
+    if (leader[i]) {
+      cBlock block = { i, i, 0, std::vector<int>(), -1, false, false };
+      blocks.push_back(block);
+    }
+    cBlock & block = blocks.back();
+    block.end = i + 1;
+    block.cost += hardware.GetInst(i)->GetCost();
+    block_of[i] = (int) blocks.size() - 1;
+  }
+
+  for (int id = 0; id < (int) blocks.size(); id++) {
+    cBlock & block = blocks[id];
+    const int last = block.end - 1;
+    const int next = (block.end < num_insts) ? block_of[block.end] : -1;
+    const int jump = (target[last] >= 0) ? block_of[target[last]] : -1;
+    switch (flow[last]) {
+    case FLOW_NEXT: block.succs.push_back(next); break;
+    case FLOW_JUMP: block.succs.push_back(jump); break;
+    case FLOW_BRANCH:
+      block.succs.push_back(next);
+      if (jump != next) block.succs.push_back(jump);
+      break;
+    case FLOW_CALL:
+      block.callee = jump;
+      block.succs.push_back(next);
+      break;
+    case FLOW_RET: block.returns = true; break;
+    case FLOW_LOST: block.unknown = true; break;
+    }
+  }
+}
+
+// Dominators (Cooper, Harvey and Kennedy), with the start of the program and of every function
+// called all hanging from one virtual root.
+void cCostEstimate::FindDominators()
+{
+  const int num_blocks = (int) blocks.size();
+  const int root = num_blocks;
+  std::vector<int> roots;
+  std::vector<bool> is_root(num_blocks, false);
+  preds.assign(num_blocks, std::vector<int>());
+  for (int id = 0; id < num_blocks; id++) {
+    if (blocks[id].callee >= 0) is_root[blocks[id].callee] = true;
+    for (int i = 0; i < (int) blocks[id].succs.size(); i++) {
+      if (blocks[id].succs[i] >= 0) preds[blocks[id].succs[i]].push_back(id);
+    }
+  }
+  if (num_blocks > 0) is_root[0] = true;
+  for (int id = 0; id < num_blocks; id++) if (is_root[id]) roots.push_back(id);
+
+  // Depth-first search for a reverse postorder, noting edges back to blocks still being searched.
+  std::vector<int> post_num(num_blocks + 1, -1);
+  std::vector<int> order;
+  std::vector<std::pair<int,int> > retreating;
+  std::vector<char> state(num_blocks + 1, 0);
+  std::vector<std::pair<int,int> > stack(1, std::make_pair(root, 0));
+  state[root] = 1;
+  while (stack.size() > 0) {
+    const int node = stack.back().first;
+    const std::vector<int> & succs = (node == root) ? roots : blocks[node].succs;
+    const int next = stack.back().second++;
+    if (next < (int) succs.size()) {
+      const int succ = succs[next];
+      if (succ < 0) continue;
+      if (state[succ] == 0) {
+        state[succ] = 1;
+        stack.push_back(std::make_pair(succ, 0));
+      }
+      else if (state[succ] == 1) retreating.push_back(std::make_pair(node, succ));
+      continue;
+    }
+    state[node] = 2;
+    post_num[node] = (int) order.size();
+    order.push_back(node);
+    stack.pop_back();
+  }
+  std::reverse(order.begin(), order.end());
+
+  std::vector<int> dom(num_blocks + 1, -1);
+  dom[root] = root;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 1; i < (int) order.size(); i++) {
+      const int node = order[i];
+      int new_dom = is_root[node] ? root : -1;
+      for (int p = 0; p < (int) preds[node].size(); p++) {
+        int other = preds[node][p];
+        if (dom[other] == -1) continue;
+        if (new_dom == -1) { new_dom = other; continue; }
+        int cur = new_dom;
+        while (cur != other) {
+          while (post_num[cur] < post_num[other]) cur = dom[cur];
+          while (post_num[other] < post_num[cur]) other = dom[other];
+        }
+        new_dom = cur;
+      }
+      if (dom[node] != new_dom) {
+        dom[node] = new_dom;
+        changed = true;
+      }
+    }
+  }
+
+  idom.assign(num_blocks, -1);
+  dom_depth.assign(num_blocks, -1);
+  for (int i = 1; i < (int) order.size(); i++) {
+    const int node = order[i];
+    if (dom[node] == root) dom_depth[node] = 0;
+    else {
+      idom[node] = dom[node];
+      dom_depth[node] = dom_depth[dom[node]] + 1;
+    }
+  }
+
+  // A cycle whose first block reached doesn't dominate the rest has more than one way in.
+  for (int i = 0; i < (int) retreating.size(); i++) {
+    if (retreating[i].first != root && !Dominates(retreating[i].second, retreating[i].first)) irreducible = true;
+  }
+}
+
+bool cCostEstimate::Dominates(int a, int b) const
+{
+  if (dom_depth[a] < 0 || dom_depth[b] < 0) return false;
+  while (dom_depth[b] > dom_depth[a]) b = idom[b];
+  return a == b;
+}
+
+// Natural loops: every edge to a block that dominates its source closes one.
+void cCostEstimate::FindLoops()
+{
+  const int num_blocks = (int) blocks.size();
+  std::vector<int> loop_at(num_blocks, -1);
+  std::vector<int> mark(num_blocks, -1);
+  for (int id = 0; id < num_blocks; id++) {
+    for (int i = 0; i < (int) blocks[id].succs.size(); i++) {
+      const int header = blocks[id].succs[i];
+      if (header < 0 || !Dominates(header, id)) continue;
+
+      if (loop_at[header] == -1) {
+        cLoop loop;
+        loop.header = header;
+        loop.blocks.push_back(header);
+        loop.parent = -1;
+        loop.passes = -1;
+        loop.returns = loop.unknown = false;
+        loop.state = 0;
+        loop_at[header] = (int) loops.size();
+        mark[header] = loop_at[header];
+        loops.push_back(loop);
+      }
+      const int loop_id = loop_at[header];
+
+      // Everything that can reach the back edge without passing through the header.
+      std::vector<int> work(1, id);
+      while (work.size() > 0) {
+        const int node = work.back();
+        work.pop_back();
+        if (mark[node] == loop_id) continue;
+        mark[node] = loop_id;
+        loops[loop_id].blocks.push_back(node);
+        for (int p = 0; p < (int) preds[node].size(); p++) {
+          if (dom_depth[preds[node][p]] >= 0) work.push_back(preds[node][p]);
+        }
+      }
+    }
+  }
+
+  // Innermost first; a loop inside another is always the smaller of the two.
+  std::vector<int> order(loops.size());
+  for (int i = 0; i < (int) order.size(); i++) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+    return loops[a].blocks.size() < loops[b].blocks.size();
+  });
+  std::vector<cLoop> sorted;
+  for (int i = 0; i < (int) order.size(); i++) sorted.push_back(loops[order[i]]);
+  loops.swap(sorted);
+
+  loop_of.assign(num_blocks, -1);
+  header_loop.assign(num_blocks, -1);
+  for (int id = 0; id < (int) loops.size(); id++) header_loop[loops[id].header] = id;
+  for (int id = 0; id < (int) loops.size(); id++) {
+    for (int i = 0; i < (int) loops[id].blocks.size(); i++) {
+      const int block = loops[id].blocks[i];
+      if (loop_of[block] == -1) loop_of[block] = id;
+      const int inner = header_loop[block];
+      if (inner != -1 && inner != id && loops[inner].parent == -1) loops[inner].parent = id;
+    }
+  }
+
+  // How each loop can be left.
+  for (int id = 0; id < (int) loops.size(); id++) {
+    cLoop & loop = loops[id];
+    for (int i = 0; i < (int) loop.blocks.size(); i++) {
+      const cBlock & block = blocks[loop.blocks[i]];
+      for (int s = 0; s < (int) block.succs.size(); s++) {
+        const int succ = block.succs[s];
+        if ((succ == -1 || !InLoop(succ, id)) &&
+            std::find(loop.exits.begin(), loop.exits.end(), succ) == loop.exits.end()) {
+          loop.exits.push_back(succ);
+        }
+      }
+      if (block.returns) loop.returns = true;
+      if (block.unknown) loop.unknown = true;
+    }
+    // A loop with no way out runs until a limit stops it.
+    if (loop.exits.size() == 0 && !loop.returns) loop.unknown = true;
+  }
+}
+
+bool cCostEstimate::InLoop(int block, int loop_id) const
+{
+  int cur = loop_of[block];
+  while (cur != -1 && cur != loop_id) cur = loops[cur].parent;
+  return cur == loop_id;
+}
+
+// Could a call to the function starting at block entry change var_id (in anything it runs)?
+bool cCostEstimate::CallMayWrite(int entry, int var_id)
+{
+  std::vector<bool> seen(blocks.size(), false);
+  std::vector<int> work(1, entry);
+  while (work.size() > 0) {
+    const int block_id = work.back();
+    work.pop_back();
+    if (seen[block_id]) continue;
+    seen[block_id] = true;
+
+    const cBlock & block = blocks[block_id];
+    if (block.unknown) return true;
+    for (int i = block.start; i < block.end; i++) {
+      cInst_Base * inst = Unwrap(hardware.GetInst(i));
+      const int written = WrittenArg(inst->GetName());
+      if (written < 0 || (written > 0 && VarID(GetArg(inst, written)) == var_id)) return true;
+    }
+    if (block.callee != -1) work.push_back(block.callee);
+    for (int i = 0; i < (int) block.succs.size(); i++) {
+      if (block.succs[i] >= 0) work.push_back(block.succs[i]);
+    }
+  }
+  return false;
+}
+
+// Value the counter var_id holds when loop_id is entered: the constant it was last set to, or
+// zero if nothing sets it since the start of the program.  False if that can't be told.
+bool cCostEstimate::StartValue(int loop_id, int var_id, double & value)
+{
+  int entry = -1;
+  const std::vector<int> & header_preds = preds[loops[loop_id].header];
+  for (int i = 0; i < (int) header_preds.size(); i++) {
+    const int pred = header_preds[i];
+    if (dom_depth[pred] < 0 || InLoop(pred, loop_id)) continue;
+    if (entry != -1) return false;
+    entry = pred;
+  }
+
+  for (int block_id = entry, tries = 0; block_id != -1 && tries < 1000; tries++) {
+    const cBlock & block = blocks[block_id];
+    if (block.callee != -1 && CallMayWrite(block.callee, var_id)) return false;
+    for (int i = block.end - 1; i >= block.start; i--) {
+      cInst_Base * inst = Unwrap(hardware.GetInst(i));
+      const std::string name = inst->GetName();
+      const int written = WrittenArg(name);
+      if (written < 0) return false;
+      if (written == 0 || VarID(GetArg(inst, written)) != var_id) continue;
+      if (name != "val_copy" || !IsConst(inst->GetArg1())) return false;
+      value = inst->GetArg1()->AsFloat();
+      return true;
+    }
+
+    // Nothing here set it; keep looking back while there is only one way in.
+    if (block_id == 0 && preds[0].size() == 0) {
+      value = 0.0;   // Everything starts at zero.
+      return true;
+    }
+    if (preds[block_id].size() != 1 || InLoop(preds[block_id][0], loop_id)) return false;
+    block_id = preds[block_id][0];
+  }
+  return false;
+}
+
+// Times the header of loop_id runs each time the loop is entered; -1 unless the loop is left
+// only by a test of a counter against a constant, where the counter starts from a constant and
+// is stepped by a constant exactly once in each pass (and nothing the loop calls changes it).
+long long cCostEstimate::CountPasses(int loop_id)
+{
+  const cLoop & loop = loops[loop_id];
+  if (loop.returns || loop.unknown) return -1;
+
+  int exit_id = -1;
+  std::vector<int> latches;   // Blocks that go back to the header.
+  for (int i = 0; i < (int) loop.blocks.size(); i++) {
+    const int block_id = loop.blocks[i];
+    const std::vector<int> & succs = blocks[block_id].succs;
+    for (int s = 0; s < (int) succs.size(); s++) {
+      if (succs[s] == loop.header) latches.push_back(block_id);
+      else if (succs[s] == -1 || !InLoop(succs[s], loop_id)) {
+        if (exit_id != -1 && exit_id != block_id) return -1;
+        exit_id = block_id;
+      }
+    }
+  }
+  if (exit_id == -1) return -1;
+  for (int i = 0; i < (int) latches.size(); i++) if (!Dominates(exit_id, latches[i])) return -1;
+
+  // The exit must be a branch on the result of the test just before it.
+  const cBlock & exit = blocks[exit_id];
+  if (exit.end - exit.start < 2) return -1;
+  cInst_Base * branch = Unwrap(hardware.GetInst(exit.end - 1));
+  cInst_Base * test = Unwrap(hardware.GetInst(exit.end - 2));
+  const std::string branch_name = branch->GetName();
+  const std::string test_name = test->GetName();
+  if (branch_name != "jump_if_0" && branch_name != "jump_if_n0") return -1;
+  if (test_name.compare(0, 5, "test_") != 0) return -1;
+  const int flag_id = VarID(test->GetArg3());
+  if (flag_id == -1 || VarID(branch->GetArg1()) != flag_id) return -1;
+
+  std::string op = test_name.substr(5);
+  int counter_id = VarID(test->GetArg1());
+  double limit = 0.0;
+  if (counter_id != -1 && IsConst(test->GetArg2())) limit = test->GetArg2()->AsFloat();
+  else if (IsConst(test->GetArg1()) && (counter_id = VarID(test->GetArg2())) != -1) {
+    limit = test->GetArg1()->AsFloat();
+    op = Mirror(op);
+  }
+  else return -1;
+  if (counter_id == flag_id) return -1;
+
+  // Does a true test keep the loop going?
+  const int target = Target(branch->GetArg2());
+  const bool jump_stays = (target >= 0 && InLoop(block_of[target], loop_id));
+  const bool continue_if_true = ((branch_name == "jump_if_n0") == jump_stays);
+
+  // Find the one step of the counter.
+  int step_inst = -1;
+  double step = 0.0;
+  for (int b = 0; b < (int) loop.blocks.size(); b++) {
+    const cBlock & block = blocks[loop.blocks[b]];
+    for (int i = block.start; i < block.end; i++) {
+      cInst_Base * inst = Unwrap(hardware.GetInst(i));
+      const std::string name = inst->GetName();
+      const int written = WrittenArg(name);
+      if (written < 0) return -1;
+      if (written == 0 || VarID(GetArg(inst, written)) != counter_id) continue;
+      if (step_inst != -1 || (name != "add" && name != "sub")) return -1;
+      if (VarID(inst->GetArg1()) == counter_id && IsConst(inst->GetArg2())) step = inst->GetArg2()->AsFloat();
+      else if (name == "add" && IsConst(inst->GetArg1()) && VarID(inst->GetArg2()) == counter_id) {
+        step = inst->GetArg1()->AsFloat();
+      }
+      else return -1;
+      if (name == "sub") step = -step;
+      step_inst = i;
+    }
+  }
+  if (step_inst == -1 || step == 0.0) return -1;
+  for (int b = 0; b < (int) loop.blocks.size(); b++) {
+    const int callee = blocks[loop.blocks[b]].callee;
+    if (callee != -1 && CallMayWrite(callee, counter_id)) return -1;
+  }
+
+  const int step_id = block_of[step_inst];
+  for (int i = 0; i < (int) latches.size(); i++) if (!Dominates(step_id, latches[i])) return -1;
+  bool stepped_first;   // Is the counter stepped before the test in each pass?
+  if (step_id == exit_id) stepped_first = (step_inst < exit.end - 2);
+  else if (Dominates(step_id, exit_id)) stepped_first = true;
+  else if (Dominates(exit_id, step_id)) stepped_first = false;
+  else return -1;
+
+  double start = 0.0;
+  if (!StartValue(loop_id, counter_id, start)) return -1;
+
+  // Whether the loop goes around again after the test in pass number pass (from 1).
+  auto Continues = [&](long long pass) {
+    const double value = start + (double) (stepped_first ? pass : pass - 1) * step;
+    return Compare(op, value, limit) == continue_if_true;
+  };
+
+  const long long MAX_PASSES = 1LL << 50;
+  if (!Continues(1)) return 1;
+  if (!Continues(2)) return 2;
+  if (!Continues(MAX_PASSES)) {
+    // The counter moves steadily toward the limit, so the passes that continue all come first.
+    long long low = 2, high = MAX_PASSES;
+    while (high - low > 1) {
+      const long long mid = low + (high - low) / 2;
+      if (Continues(mid)) low = mid;
+      else high = mid;
+    }
+    return high;
+  }
+
+  // A loop that only stops when the counter equals the limit exactly.
+  const double at_limit = (limit - start) / step + (stepped_first ? 0.0 : 1.0);
+  if (at_limit >= 3.0 && at_limit < (double) MAX_PASSES && at_limit == std::floor(at_limit) &&
+      !Continues((long long) at_limit)) {
+    return (long long) at_limit;
+  }
+  return -1;
+}
+
+// Cycles along the paths from block start, taking any loop directly inside loop_id (or inside
+// no loop, if loop_id is -1) as a whole.  With around, the paths are those back to the header
+// of loop_id; otherwise they are those that leave it, or the function or program.
+cCostEstimate::cRange cCostEstimate::PathCost(int start, int loop_id, bool around)
+{
+  const cRange none = { 0, 0, false };
+  const cRange done = { 0, 0, true };
+  const cRange open = { 0, UNBOUNDED, true };
+
+  auto Follow = [&](int succ) {
+    if (succ == -1) return around ? EDGE_NONE : EDGE_END;
+    if (loop_id != -1 && succ == loops[loop_id].header) return around ? EDGE_END : EDGE_NONE;
+    if (loop_id != -1 && !InLoop(succ, loop_id)) return around ? EDGE_NONE : EDGE_END;
+    return EDGE_FOLLOW;
+  };
+
+  // Blocks are taken one at a time, except for the header of a nested loop, which stands for the
+  // whole loop.
+  struct cStep {
+    const std::vector<int> * succs;
+    bool returns;
+    bool unknown;
+  };
+  auto GetStep = [&](int block_id) {
+    const int inner = header_loop[block_id];
+    cStep step;
+    if (inner != -1 && inner != loop_id && loops[inner].parent == loop_id) {
+      step.succs = &loops[inner].exits;
+      step.returns = loops[inner].returns;
+      step.unknown = loops[inner].unknown;
+    }
+    else {
+      step.succs = &blocks[block_id].succs;
+      step.returns = blocks[block_id].returns;
+      step.unknown = blocks[block_id].unknown;
+    }
+    return step;
+  };
+  auto StepCost = [&](int block_id) {
+    const int inner = header_loop[block_id];
+    if (inner != -1 && inner != loop_id && loops[inner].parent == loop_id) return LoopCost(inner);
+    const cBlock & block = blocks[block_id];
+    cRange cost = { block.cost, block.cost, true };
+    if (block.callee != -1) cost = Add(cost, CallCost(block.callee));
+    return cost;
+  };
+
+  // Depth-first, working out each block once everything after it is known.
+  std::vector<cRange> memo(blocks.size(), none);
+  std::vector<char> state(blocks.size(), 0);
+  std::vector<int> stack(1, start);
+  while (stack.size() > 0) {
+    const int block_id = stack.back();
+    if (state[block_id] == 2) {
+      stack.pop_back();
+      continue;
+    }
+    const cStep step = GetStep(block_id);
+    if (state[block_id] == 0) {
+      state[block_id] = 1;
+      for (int i = 0; i < (int) step.succs->size(); i++) {
+        const int succ = (*step.succs)[i];
+        if (Follow(succ) == EDGE_FOLLOW && state[succ] == 0) stack.push_back(succ);
+      }
+      continue;
+    }
+
+    cRange after = none;
+    if (step.returns && !around) after = Merge(after, done);
+    if (step.unknown) after = Merge(after, open);
+    for (int i = 0; i < (int) step.succs->size(); i++) {
+      const int succ = (*step.succs)[i];
+      switch (Follow(succ)) {
+      case EDGE_END: after = Merge(after, done); break;
+      case EDGE_NONE: break;
+      case EDGE_FOLLOW:
+        if (state[succ] == 2) after = Merge(after, memo[succ]);
+        else {
+          irreducible = true;   // Back around a cycle that isn't a loop of its own.
+          after = Merge(after, open);
+        }
+        break;
+      }
+    }
+    memo[block_id] = Add(StepCost(block_id), after);
+    state[block_id] = 2;
+    stack.pop_back();
+  }
+  return memo[start];
+}
+
+// Cycles from entering loop_id to leaving it.
+cCostEstimate::cRange cCostEstimate::LoopCost(int loop_id)
+{
+  const cRange open = { 0, UNBOUNDED, true };
+  cLoop & loop = loops[loop_id];
+  if (loop.state == 2) return loop.cost;
+  if (loop.state == 1) return open;   // Reached again through a recursive call.
+  loop.state = 1;
+
+  loop.passes = CountPasses(loop_id);
+  loop.pass_cost = PathCost(loop.header, loop_id, true);
+  const cRange last = PathCost(loop.header, loop_id, false);   // The pass that leaves.
+
+  if (!last.valid) {
+    // Runs until a limit stops it.
+    loop.cost.min = loop.pass_cost.valid ? loop.pass_cost.min : 0;
+    loop.cost.max = UNBOUNDED;
+    loop.cost.valid = true;
+  }
+  else if (loop.passes > 1 && loop.pass_cost.valid) {
+    const cRange around = { Times(loop.pass_cost.min, loop.passes - 1),
+                            Times(loop.pass_cost.max, loop.passes - 1), true };
+    loop.cost = Add(around, last);
+  }
+  else if (loop.passes == 1) loop.cost = last;
+  else {
+    loop.cost = last;
+    if (loop.pass_cost.valid) loop.cost.max = UNBOUNDED;
+  }
+
+  loop.state = 2;
+  return loop.cost;
+}
+
+// Cycles for a call to the function starting at block entry, up to its ret.
+cCostEstimate::cRange cCostEstimate::CallCost(int entry)
+{
+  const cRange open = { 0, UNBOUNDED, true };
+  if (call_state.size() == 0) {
+    call_state.assign(blocks.size(), 0);
+    call_costs.assign(blocks.size(), open);
+  }
+  if (call_state[entry] == 1) return open;   // Recursive.
+  if (call_state[entry] == 2) return call_costs[entry];
+
+  call_state[entry] = 1;
+  cRange cost = PathCost(entry, -1, false);
+  if (!cost.valid) cost = open;
+  call_costs[entry] = cost;
+  call_state[entry] = 2;
+  return cost;
+}
+
+void cCostEstimate::Print(std::ostream & out) const
+{
+  out << "Basic blocks: " << blocks.size() << "  Loops: " << loops.size() << std::endl;
+
+  std::vector<int> order(loops.size());
+  for (int i = 0; i < (int) order.size(); i++) order[i] = i;
+  std::sort(order.begin(), order.end(), [this](int a, int b) {
+    return blocks[loops[a].header].start < blocks[loops[b].header].start;
+  });
+  for (int i = 0; i < (int) order.size(); i++) {
+    const cLoop & loop = loops[order[i]];
+    out << "  Loop at line " << hardware.GetInst(blocks[loop.header].start)->GetLineNum() << ": ";
+    if (loop.passes >= 0) out << loop.passes << (loop.passes == 1 ? " pass" : " passes");
+    else out << "no bound found";
+    out << ", ";
+    PrintCycles(out, loop.cost.min, loop.cost.max);
+    out << " cycles each time it is entered" << std::endl;
+  }
+  if (irreducible) out << "  Some loops can be entered in more than one place." << std::endl;
+
+  out << "Estimated cycles: ";
+  PrintCycles(out, total.min, total.max);
+  out << std::endl;
+}
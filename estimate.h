@@ -0,0 +1,96 @@
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include <ostream>
+#include <vector>
+
+#include "hardware.h"
+
+// Estimates how many cycles a program will take without running it.  The program is split into
+// basic blocks at jumps and their targets, each costing exactly the sum of its instructions'
+// GetCost(); loops are found from the dominator tree.  A loop whose only exit is a test of a
+// counter against a constant (the counter set to a constant beforehand, stepped by a constant
+// once per pass, and left alone by anything called) runs a known number of times; any other
+// loop, a jump to a computed position, or a recursive call leaves the estimate without an upper
+// bound.  The extra cycles that bulk instructions charge in proportion to their sizes are not
+// included.
+class cCostEstimate {
+public:
+  static const long long UNBOUNDED = -1;
+
+private:
+  // Cycles along some set of paths; max is UNBOUNDED if there is no limit, and a range with
+  // valid false means there are no such paths.
+  struct cRange {
+    long long min;
+    long long max;
+    bool valid;
+  };
+
+  struct cBlock {
+    int start;                // First instruction in the block.
+    int end;                  // One past the last instruction.
+    long long cost;           // Cycles to run the block itself.
+    std::vector<int> succs;   // Blocks control may pass to; -1 for the end of the program.
+    int callee;               // Block called at the end of this one, or -1.
+    bool returns;             // Ends with a ret.
+    bool unknown;             // Ends by moving to a position that isn't known statically.
+  };
+
+  struct cLoop {
+    int header;
+    std::vector<int> blocks;  // All blocks in the loop, including nested loops and the header.
+    int parent;               // Innermost loop containing this one, or -1.
+    std::vector<int> exits;   // Blocks outside that the loop can go to; -1 for the end.
+    bool returns;             // Can it leave through a ret?
+    bool unknown;             // Can it leave for a position that isn't known (or not leave)?
+    long long passes;         // Times the header runs each time the loop is entered, or -1.
+    cRange pass_cost;         // One pass that goes around again.
+    cRange cost;              // Everything from entering the loop to leaving it.
+    char state;               // 0 = cost not yet worked out, 1 = in progress, 2 = done.
+  };
+
+  cHardware & hardware;
+  std::vector<cBlock> blocks;
+  std::vector<int> block_of;          // Block containing each instruction.
+  std::vector<std::vector<int> > preds;
+  std::vector<int> idom;              // Immediate dominator of each block (-1 for roots).
+  std::vector<int> dom_depth;
+  std::vector<cLoop> loops;           // Innermost loops first.
+  std::vector<int> loop_of;           // Innermost loop containing each block, or -1.
+  std::vector<int> header_loop;       // Loop headed by each block, or -1.
+  std::vector<cRange> call_costs;     // Cost of calling each block (valid once computed).
+  std::vector<char> call_state;       // 0 = not yet computed, 1 = in progress, 2 = done.
+  bool irreducible;                   // Is there a loop with more than one way in?
+  cRange total;
+
+  static cRange Add(cRange a, cRange b);
+  static cRange Merge(cRange a, cRange b);
+  static long long Times(long long cost, long long count);
+
+  int Target(cInstArg_Base * arg);
+  void FindBlocks();
+  void FindDominators();
+  bool Dominates(int a, int b) const;
+  void FindLoops();
+  bool InLoop(int block, int loop_id) const;
+  bool CallMayWrite(int entry, int var_id);
+  bool StartValue(int loop_id, int var_id, double & value);
+  long long CountPasses(int loop_id);
+  cRange PathCost(int start, int loop_id, bool around);
+  cRange LoopCost(int loop_id);
+  cRange CallCost(int entry);
+
+public:
+  cCostEstimate(cHardware & _hardware);
+  ~cCostEstimate() { ; }
+
+  long long GetMinCycles() const { return total.min; }
+  long long GetMaxCycles() const { return total.max; }   // UNBOUNDED if no limit was found.
+  int GetNumBlocks() const { return (int) blocks.size(); }
+  int GetNumLoops() const { return (int) loops.size(); }
+
+  void Print(std::ostream & out) const;
+};
+
+#endif
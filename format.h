@@ -0,0 +1,109 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <cmath>
+#include <stdio.h>
+
+// Number formatting for program output, written straight into a caller's buffer.  Results are
+// byte-for-byte what a default std::ostream prints (6 significant digits for floating point),
+// without building a stream for every number.
+
+static const int FORMAT_BUFFER_SIZE = 32;   // Enough for any value either function writes.
+
+// Write value in decimal; returns the number of characters written.
+inline int FormatInt(long long value, char * out)
+{
+  char digits[24];
+  int num_digits = 0;
+  unsigned long long magnitude = (value < 0) ? 0ULL - (unsigned long long) value : (unsigned long long) value;
+  do {
+    digits[num_digits++] = (char) ('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0);
+
+  int size = 0;
+  if (value < 0) out[size++] = '-';
+  while (num_digits > 0) out[size++] = digits[--num_digits];
+  return size;
+}
+
+// Write value as "%g" would; returns the number of characters written.  The six digits come from
+// scaling by powers of ten in double precision; a value too close to halfway between two results
+// for that to settle its rounding (or that isn't finite) is left to snprintf, which rounds exactly.
+inline int FormatFloat(double value, char * out)
+{
+  static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  static const int MAX_POWER = 22;
+
+  if (value == 0.0) {
+    int size = 0;
+    if (std::signbit(value)) out[size++] = '-';
+    out[size++] = '0';
+    return size;
+  }
+
+  const double magnitude = std::fabs(value);
+  const bool in_range = std::isfinite(magnitude) && magnitude >= 1e-300;
+  int exp10 = in_range ? (int) std::floor(std::log10(magnitude)) : 0;
+  long long digits = 0;
+  bool found = false;
+  for (int tries = 0; in_range && tries < 3; tries++) {
+    // Scale into [100000, 1000000), using only powers of ten that doubles hold exactly.
+    double scaled = magnitude;
+    int shift = 5 - exp10;
+    while (shift > MAX_POWER) { scaled *= powers[MAX_POWER]; shift -= MAX_POWER; }
+    while (shift < -MAX_POWER) { scaled /= powers[MAX_POWER]; shift += MAX_POWER; }
+    if (shift >= 0) scaled *= powers[shift];
+    else scaled /= powers[-shift];
+
+    // log10() may be off by one either way near a power of ten.
+    if (scaled >= 1000000.0) { exp10++; continue; }
+    if (scaled < 100000.0) { exp10--; continue; }
+
+    const double whole = std::floor(scaled);
+    const double frac = scaled - whole;
+    if (std::fabs(frac - 0.5) < 1e-6) break;
+    digits = (long long) whole + ((frac > 0.5) ? 1 : 0);
+    if (digits == 1000000) { digits = 100000; exp10++; }   // Rounded up to the next power of ten.
+    found = true;
+    break;
+  }
+  if (!found) return snprintf(out, FORMAT_BUFFER_SIZE, "%g", value);
+
+  char digit_chars[6];
+  for (int i = 5; i >= 0; i--) { digit_chars[i] = (char) ('0' + digits % 10); digits /= 10; }
+  int num_digits = 6;
+  while (num_digits > 1 && digit_chars[num_digits - 1] == '0') num_digits--;   // %g drops these.
+
+  int size = 0;
+  if (value < 0) out[size++] = '-';
+  if (exp10 >= -4 && exp10 < 6) {
+    if (exp10 < 0) {
+      out[size++] = '0';
+      out[size++] = '.';
+      for (int i = -1; i > exp10; i--) out[size++] = '0';
+      for (int i = 0; i < num_digits; i++) out[size++] = digit_chars[i];
+    } else {
+      for (int i = 0; i <= exp10; i++) out[size++] = (i < num_digits) ? digit_chars[i] : '0';
+      if (num_digits > exp10 + 1) {
+        out[size++] = '.';
+        for (int i = exp10 + 1; i < num_digits; i++) out[size++] = digit_chars[i];
+      }
+    }
+    return size;
+  }
+
+  out[size++] = digit_chars[0];
+  if (num_digits > 1) {
+    out[size++] = '.';
+    for (int i = 1; i < num_digits; i++) out[size++] = digit_chars[i];
+  }
+  out[size++] = 'e';
+  out[size++] = (exp10 < 0) ? '-' : '+';
+  const int exp_magnitude = (exp10 < 0) ? -exp10 : exp10;
+  if (exp_magnitude < 10) out[size++] = '0';
+  return size + FormatInt(exp_magnitude, out + size);
+}
+
+#endif
@@ -1,21 +1,255 @@
 #include "hardware.h"
 
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+
+// Storage for the page constants, which std::min() and make_shared() take by reference.
+const int cMemory::PAGE_BITS;
+const int cMemory::PAGE_SIZE;
+const int cMemory::PAGE_MASK;
+
+void cMemory::Fill(int pos, int count, tValue value)
+{
+  while (count > 0) {
+    const int offset = pos & PAGE_MASK;
+    const int chunk = std::min(count, PAGE_SIZE - offset);
+    if (chunk == PAGE_SIZE && value == 0.0f && !std::signbit(value)) {
+      pages[pos >> PAGE_BITS] = ZeroPage();   // A whole page of zeros can go back to sharing.
+    } else {
+      tPage & page = MutablePage(pos >> PAGE_BITS);
+      std::fill(page.begin() + offset, page.begin() + offset + chunk, value);
+    }
+    pos += chunk;
+    count -= chunk;
+  }
+}
+
+// Copies as if through a temporary buffer, so overlapping ranges are handled: chunks run front to
+// back when moving down in memory, and back to front when moving up.
+void cMemory::Move(int from, int to, int count)
+{
+  if (from == to || count <= 0) return;
+
+  if (to < from) {
+    for (int done = 0; done < count; ) {
+      const int src = from + done, dest = to + done;
+      int chunk = std::min(count - done, PAGE_SIZE - (src & PAGE_MASK));
+      chunk = std::min(chunk, PAGE_SIZE - (dest & PAGE_MASK));
+      tValue * dest_ptr = &MutablePage(dest >> PAGE_BITS)[dest & PAGE_MASK];  // Unshare before reading.
+      memmove(dest_ptr, &(*pages[src >> PAGE_BITS])[src & PAGE_MASK], chunk * sizeof(tValue));
+      done += chunk;
+    }
+  } else {
+    for (int left = count; left > 0; ) {
+      const int src_end = from + left, dest_end = to + left;
+      int chunk = std::min(left, ((src_end - 1) & PAGE_MASK) + 1);
+      chunk = std::min(chunk, ((dest_end - 1) & PAGE_MASK) + 1);
+      const int src = src_end - chunk, dest = dest_end - chunk;
+      tValue * dest_ptr = &MutablePage(dest >> PAGE_BITS)[dest & PAGE_MASK];
+      memmove(dest_ptr, &(*pages[src >> PAGE_BITS])[src & PAGE_MASK], chunk * sizeof(tValue));
+      left -= chunk;
+    }
+  }
+}
+
+// Partial sums are kept by (position mod 8) and combined in a fixed order, so the inner loop
+// vectorizes and the result does not depend on how the range falls across pages.
+tValue cMemory::Sum(int pos, int count) const
+{
+  const int LANES = 8;
+  tValue lanes[LANES] = { 0 };
+  const int end = pos + count;
+  while (pos < end && (pos & (LANES-1)) != 0) { lanes[pos & (LANES-1)] += (*this)[pos]; pos++; }
+  while (pos + LANES <= end) {
+    const tValue * data = &(*pages[pos >> PAGE_BITS])[pos & PAGE_MASK];
+    const int block_end = std::min(end, (pos | PAGE_MASK) + 1) & ~(LANES-1);
+    const int num_blocks = (block_end - pos) / LANES;
+    for (int block = 0; block < num_blocks; block++) {
+      for (int j = 0; j < LANES; j++) lanes[j] += data[block * LANES + j];
+    }
+    pos += num_blocks * LANES;
+  }
+  while (pos < end) { lanes[pos & (LANES-1)] += (*this)[pos]; pos++; }
+
+  tValue total = lanes[0];
+  for (int j = 1; j < LANES; j++) total += lanes[j];
+  return total;
+}
+
+// Returns -1, 0, or 1, based on the first position where the two ranges differ.
+int cMemory::Compare(int pos1, int pos2, int count) const
+{
+  for (int done = 0; done < count; ) {
+    const int p1 = pos1 + done, p2 = pos2 + done;
+    int chunk = std::min(count - done, PAGE_SIZE - (p1 & PAGE_MASK));
+    chunk = std::min(chunk, PAGE_SIZE - (p2 & PAGE_MASK));
+    const tValue * data1 = &(*pages[p1 >> PAGE_BITS])[p1 & PAGE_MASK];
+    const tValue * data2 = &(*pages[p2 >> PAGE_BITS])[p2 & PAGE_MASK];
+    if (data1 != data2) {
+      for (int i = 0; i < chunk; i++) {
+        if (data1[i] != data2[i]) return (data1[i] < data2[i]) ? -1 : 1;
+      }
+    }
+    done += chunk;
+  }
+  return 0;
+}
+
+
+// Forks share a program until one of them changes it.  The copy gets an arena of its own, with
+// its own copies of the instructions, since edits shift their line numbers and relink their labels.
+void cHardware::EditProgram()
+{
+  if (program.use_count() == 1) return;
+  RebuildProgram();
+}
+
+// Replace the program with a copy built in a fresh arena, leaving behind anything no longer used.
+void cHardware::RebuildProgram()
+{
+  std::shared_ptr<cProgram> copy = std::make_shared<cProgram>();
+  copy->label_map = program->label_map;
+  copy->imports = program->imports;
+  copy->labels_reused = program->labels_reused;
+  copy->inst_vector.reserve(program->inst_vector.size());
+  for (int i = 0; i < (int) program->inst_vector.size(); i++) {
+    cInst_Base * inst = program->inst_vector[i]->Clone(*(copy->arena));
+    inst->SetHardware(this);
+    copy->inst_vector.push_back(inst);
+  }
+  program = copy;
+}
+
+// Instructions replaced by edits stay in the arena until it is rebuilt, which is done once they
+// outnumber the live ones so that a long editing session doesn't grow without bound.
+void cHardware::ReclaimProgram()
+{
+  if (program->dead_insts > (int) program->inst_vector.size()) RebuildProgram();
+}
+
 void cHardware::AddInst(cInst_Base * inst)
 {
+  EditProgram();
+  inst->SetHardware(this);
+  if (replace_first >= 0) replace_insts.push_back(inst);
+  else program->inst_vector.push_back(inst);
+}
+
+void cHardware::SetInst(int inst_id, cInst_Base * inst)
+{
+  EditProgram();
   inst->SetHardware(this);
-  inst_vector.push_back(inst);
+  program->inst_vector[inst_id] = inst;
+  program->dead_insts++;
 }
 
-void cHardware::AddLabel(std::string _l)
+void cHardware::AddLabel(std::string _l, int pos)
 {
+  EditProgram();
+  std::map<std::string,int> & label_map = program->label_map;
   if (label_map.find(_l) != label_map.end()) {
     (*this) << "Warning: label '" << _l << "' being reused!" << '\n';
+    program->labels_reused = true;
+  }
+  if (pos < 0) {  // The position of the next instruction to be added.
+    pos = (replace_first >= 0) ? replace_first + (int) replace_insts.size() : (int) program->inst_vector.size();
+  }
+  label_map[_l] = pos;
+}
+
+void cHardware::BeginReplace(int first, int count)
+{
+  EditProgram();
+  replace_first = first;
+  replace_count = count;
+  replace_insts.clear();
+  replace_labels.clear();
+
+  // Labels on the replaced instructions are parsed again; those after them are set aside until
+  // it is known how far they move.
+  std::map<std::string,int> & label_map = program->label_map;
+  for (auto label_it = label_map.begin(); label_it != label_map.end(); ) {
+    if (label_it->second < first) label_it++;
+    else {
+      if (label_it->second > first + count) replace_labels.push_back(*label_it);
+      label_it = label_map.erase(label_it);
+    }
+  }
+}
+
+bool cHardware::EndReplace(int line_shift)
+{
+  std::vector<cInst_Base *> & inst_vector = program->inst_vector;
+  const int first = replace_first;
+  const int old_end = first + replace_count;
+  replace_first = -1;
+
+  // The instruction just after the edit was parsed again only for its labels.
+  program->dead_insts += replace_count;
+  program->dead_insts += (int) program->spare_traps.size();   // Their line numbers would be stale.
+  program->spare_traps.clear();
+  if (old_end < (int) inst_vector.size() && replace_insts.size() > 0) {
+    replace_insts.pop_back();
+    program->dead_insts++;
+  }
+  const int new_end = first + (int) replace_insts.size();
+  const int shift = new_end - old_end;
+
+  inst_vector.erase(inst_vector.begin() + first, inst_vector.begin() + old_end);
+  inst_vector.insert(inst_vector.begin() + first, replace_insts.begin(), replace_insts.end());
+  replace_insts.clear();
+
+  // Later definitions of a label win, as they would in a full parse.
+  for (int i = 0; i < (int) replace_labels.size(); i++) {
+    if (program->label_map.count(replace_labels[i].first) > 0) program->labels_reused = true;
+    program->label_map[replace_labels[i].first] = replace_labels[i].second + shift;
+  }
+  replace_labels.clear();
+
+  // Labels may have moved under any instruction, and those after the edit are on new lines.
+  for (int i = 0; i < (int) inst_vector.size(); i++) {
+    inst_vector[i]->Relink();
+    if (i < new_end) continue;
+    if (cInst_BREAK * trap = dynamic_cast<cInst_BREAK *>(inst_vector[i])) {
+      trap->GetOriginal()->ShiftLineNum(line_shift);
+    }
+    inst_vector[i]->ShiftLineNum(line_shift);
+  }
+
+  // Move positions held in the current state along with their instructions.
+  bool keep_state = true;
+  auto Relocate = [first, old_end, shift, &keep_state](int & pos) {
+    if (pos >= old_end) pos += shift;
+    else if (pos >= first) keep_state = false;
+  };
+  Relocate(IP);
+  if (break_IP >= 0) Relocate(break_IP);
+  if (resume_IP >= 0) Relocate(resume_IP);
+  for (int i = 0; i < (int) call_stack.size(); i++) Relocate(call_stack[i]);
+
+  ReclaimProgram();
+
+  if (!keep_state) {
+    Restart();
+    return false;
   }
-  label_map[_l] = (int) inst_vector.size(); // The current size represents the value of the next line.
+
+  // Steps from before the edit can't be undone, and loop checks start over on the new program.
+  undo_steps.clear();
+  undo_entries.clear();
+  undo_base = 0;
+  loop_jump_count = 0;
+  jumped_back = false;
+  loop_check_count = 0;
+  loop_next_save = 1;
+  changes.full = true;
+  return true;
 }
 
 int cHardware::FindLabel(std::string _l)
 {
+  std::map<std::string,int> & label_map = program->label_map;
   if (label_map.find(_l) == label_map.end()) {
     std::string error_str = "Unknown label '";
     error_str += _l;
@@ -28,31 +262,1061 @@ int cHardware::FindLabel(std::string _l)
 
 bool cHardware::RunStep()
 {
-  if (IP >= (int) inst_vector.size()) return false;
+  const std::vector<cInst_Base *> & inst_vector = program->inst_vector;
+  if (IP >= (int) inst_vector.size()) {
+    if (halt_type != HALT_BREAK) return false;
+    ContinueFromBreak();
+  }
 
   advance_IP = true;  // By default, advance the instruction pointer after execution unless turned off.
 
-  exe_count += inst_vector[IP]->GetCost();
-  inst_vector[IP]->Run();
-  
-  if (timeout >= 0 && exe_count >= timeout) {
-    (*this) << "Reached execution count limit of " << timeout << ".  Halting." << '\n';
-    IP = inst_vector.size(); // Move IP to end to stop further execution.
+  if (undo_limit > 0) JournalStep();
+
+  if (wall_limit >= 0 && --wall_countdown <= 0) {
+    CheckWallTime();
+    if (halt_type != HALT_NONE) return false;
   }
+
+  // Instructions shared with a fork must be pointed back at this hardware before they run.
+  cInst_Base * inst = inst_vector[IP];
+  if (inst->GetHardware() != this) inst->SetHardware(this);
+
+  exe_count += inst->GetCost();
+  inst->Run();
   
   if (advance_IP) IP++;
 
+  if (jumped_back) {
+    jumped_back = false;
+    if (++loop_jump_count >= loop_check_freq) {
+      loop_jump_count = 0;
+      CheckLoop();
+    }
+  }
+
+  if (timeout >= 0 && exe_count >= timeout && halt_type == HALT_NONE) {
+    (*this) << "Reached execution count limit of " << timeout << ".  Halting." << '\n';
+    Halt(HALT_TIMEOUT);
+  }
+
+  if (watch_stop) StopAtWatch();
+
   return true;
 }
 
 
 bool cHardware::Run()
 {
-  while (IP >= 0 && IP < (int) inst_vector.size()) {
+  if (resume_file.size() > 0) {
+    if (!LoadStateFile(resume_file)) {
+      Halt(HALT_ERROR);
+      return false;
+    }
+    resume_file = "";
+    if (print_to_console) std::cout << iout.str();  // Replay what the run printed before its checkpoint.
+    if (checkpoint_interval > 0) next_checkpoint = exe_count + checkpoint_interval;
+  }
+  if (halt_type == HALT_BREAK) ContinueFromBreak();
+
+  while (IP >= 0 && IP < (int) program->inst_vector.size()) {
+    RunStep();
+    if (checkpoint_interval > 0 && exe_count >= next_checkpoint) {
+      SaveStateFile(checkpoint_file);
+      next_checkpoint = exe_count + checkpoint_interval;
+    }
+  }
+  if (halt_type == HALT_NONE) halt_type = HALT_END;
+
+  PrintCycles();
+
+  return true;
+}
+
+void cHardware::PrintCycles()
+{
+  if (count_cycles && halt_type != HALT_BREAK && halt_type != HALT_ERROR) (*this) << "[[ Total CPU cycles used: " << exe_count << " ]]" << '\n';
+}
+
+
+// Execute at most num_steps instructions, stopping early if the program ends.
+// Returns the number of instructions actually executed.
+int cHardware::RunSteps(int num_steps)
+{
+  int steps = 0;
+  if (halt_type == HALT_BREAK && num_steps > 0) ContinueFromBreak();
+  while (steps < num_steps && IP >= 0 && IP < (int) program->inst_vector.size()) {
     RunStep();
+    steps++;
+  }
+  if (halt_type == HALT_NONE && (IP < 0 || IP >= (int) program->inst_vector.size())) halt_type = HALT_END;
+
+  return steps;
+}
+
+
+bool cHardware::SetBreakpoint(int inst_id, const tBreakCondition & condition)
+{
+  if (inst_id < 0 || inst_id >= GetNumInsts()) return false;
+  EditProgram();   // Traps are never shared with a fork past this, so they can be changed in place.
+  cInst_Base *& slot = program->inst_vector[inst_id];
+  if (cInst_BREAK * trap = dynamic_cast<cInst_BREAK *>(slot)) {
+    trap->SetCondition(condition);
+    return true;
   }
 
-  if (count_cycles) (*this) << "[[ Total CPU cycles used: " << exe_count << " ]]" << '\n';
+  // A trap cleared from this instruction before is put back rather than built again.
+  std::map<cInst_Base *, cInst_BREAK *> & spare_traps = program->spare_traps;
+  auto spare_it = spare_traps.find(slot);
+  if (spare_it != spare_traps.end()) {
+    cInst_BREAK * trap = spare_it->second;
+    spare_traps.erase(spare_it);
+    trap->SetCondition(condition);
+    slot = trap;
+  }
+  else slot = program->arena->New<cInst_BREAK>(slot, condition);
+  slot->SetHardware(this);
+  return true;
+}
 
+bool cHardware::ClearBreakpoint(int inst_id)
+{
+  if (!HasBreakpoint(inst_id)) return false;
+  EditProgram();
+  cInst_Base *& slot = program->inst_vector[inst_id];
+  cInst_BREAK * trap = static_cast<cInst_BREAK *>(slot);
+  slot = trap->GetOriginal();
+  program->spare_traps[slot] = trap;
+  if (inst_id == resume_IP) resume_IP = -1;
   return true;
 }
+
+void cHardware::ClearAllBreakpoints()
+{
+  for (int i = 0; i < GetNumInsts(); i++) ClearBreakpoint(i);
+}
+
+bool cHardware::HasBreakpoint(int inst_id) const
+{
+  if (inst_id < 0 || inst_id >= GetNumInsts()) return false;
+  return dynamic_cast<cInst_BREAK *>(program->inst_vector[inst_id]) != NULL;
+}
+
+// Called by a breakpoint trap as it runs; returns true if execution should stop before the
+// instruction underneath it.
+bool cHardware::StopAtBreakpoint(const tBreakCondition & condition)
+{
+  // Continuing from this breakpoint runs the instruction rather than stopping again.
+  if (resume_IP == IP) {
+    resume_IP = -1;
+    return false;
+  }
+  resume_IP = -1;
+  if (condition && !condition(*this)) return false;
+
+  // Nothing has run, so take back the step's cost and its (empty) undo record.
+  exe_count -= program->inst_vector[IP]->GetCost();
+  if (undo_limit > 0 && undo_steps.size() > 0) undo_steps.pop_back();
+  break_IP = resume_IP = IP;
+  Halt(HALT_BREAK);
+  return true;
+}
+
+
+bool cHardware::AddWatchpoint(const std::string & what, int access, bool stop)
+{
+  cWatchpoint watch;
+  watch.name = what;
+  watch.id = 0;
+  watch.start = 0;
+  watch.count = 1;
+  watch.access = access;
+  watch.stop = stop;
+
+  // Split off an optional "[first]" or "[first-last]".
+  std::string base = what;
+  const size_t open_pos = what.find('[');
+  if (open_pos != std::string::npos) {
+    if (what[what.size() - 1] != ']') return false;
+    base = what.substr(0, open_pos);
+    std::string range = what.substr(open_pos + 1, what.size() - open_pos - 2);
+    const size_t dash_pos = range.find('-', 1);
+    if (dash_pos != std::string::npos) range[dash_pos] = ' ';
+    std::stringstream range_ss(range);
+    int last = -1;
+    range_ss >> watch.start;
+    if (dash_pos == std::string::npos) last = watch.start;
+    else range_ss >> last;
+    std::string extra;
+    if (range_ss.fail() || (range_ss >> extra) || watch.start < 0 || last < watch.start) return false;
+    watch.count = last - watch.start + 1;
+  }
+
+  const bool has_number = base.size() > 1 && base.find_first_not_of("0123456789", 1) == std::string::npos;
+  if (base == "mem" && open_pos != std::string::npos) {
+    if ((long long) watch.start + watch.count > (long long) mem_array.size()) return false;
+    watch.target = WATCH_MEM;
+  }
+  else if (base.size() == 4 && base.compare(0, 3, "reg") == 0 && base[3] >= 'A' && base[3] <= 'Z' &&
+           open_pos == std::string::npos) {
+    watch.target = WATCH_VAR;
+    watch.id = base[3] - 'A';
+  }
+  else if (base[0] == 's' && has_number && open_pos == std::string::npos) {
+    watch.target = WATCH_VAR;
+    watch.id = atoi(base.c_str() + 1);
+  }
+  else if (base[0] == 'a' && has_number && open_pos != std::string::npos) {
+    watch.target = WATCH_ARRAY;
+    watch.id = atoi(base.c_str() + 1);
+  }
+  else return false;
+
+  watchpoints.push_back(watch);
+  watch_targets |= 1 << watch.target;
+  if (watch.target == WATCH_MEM) {
+    const int last_page = (watch.start + watch.count - 1) >> MEM_PAGE_BITS;
+    for (int page = watch.start >> MEM_PAGE_BITS; page <= last_page; page++) mem_page_watched[page] = true;
+  }
+  return true;
+}
+
+void cHardware::ClearWatchpoints()
+{
+  watchpoints.clear();
+  watch_targets = 0;
+  mem_page_watched.assign(mem_page_watched.size(), false);
+  watch_stop = false;
+}
+
+// Report an access to pos (in variable or array id) if it is watched; value is what was read or
+// written, if known.
+void cHardware::NoteWatch(int target, int id, int pos, int access, const tValue * value)
+{
+  for (int i = 0; i < (int) watchpoints.size(); i++) {
+    const cWatchpoint & watch = watchpoints[i];
+    if ((watch.access & access) == 0 || !watch.Covers(target, id, pos)) continue;
+
+    const int line_num = (IP >= 0 && IP < GetNumInsts()) ? program->inst_vector[IP]->GetLineNum() : -1;
+    (*this) << "[[ Watch: line " << line_num << ((access == WATCH_READ) ? " read " : " wrote ");
+    if (target == WATCH_MEM) (*this) << "mem[" << pos << "]";
+    else if (target == WATCH_ARRAY) (*this) << "a" << id << "[" << pos << "]";
+    else (*this) << watch.name;
+    if (value != NULL) (*this) << " = " << *value;
+    (*this) << " ]]" << '\n';
+
+    if (watch.stop) watch_stop = true;
+    return;
+  }
+}
+
+// Report accesses to any watched positions in a range of memory.
+void cHardware::NoteWatchMem(int start, int count, int access)
+{
+  if (count <= 0) return;
+  const int last_page = (start + count - 1) >> MEM_PAGE_BITS;
+  for (int page = start >> MEM_PAGE_BITS; page <= last_page; page++) {
+    if (mem_page_watched[page] == false) continue;
+    const int first = std::max(start, page << MEM_PAGE_BITS);
+    const int last = std::min(start + count, (page + 1) << MEM_PAGE_BITS);
+    for (int pos = first; pos < last; pos++) {
+      const tValue value = mem_array[pos];
+      NoteWatch(WATCH_MEM, 0, pos, access, &value);
+    }
+  }
+}
+
+// Report accesses to any watched elements of an array used as a whole.
+void cHardware::NoteWatchArray(int id, int access, bool has_values)
+{
+  const cArray & array = array_map[id];
+  for (int i = 0; i < (int) watchpoints.size(); i++) {
+    const cWatchpoint & watch = watchpoints[i];
+    if (watch.target != WATCH_ARRAY || watch.id != id || (watch.access & access) == 0) continue;
+    const int last = std::min(watch.start + watch.count, array.GetSize());
+    for (int idx = watch.start; idx < last; idx++) {
+      const tValue value = array.GetIndex(idx);
+      NoteWatch(WATCH_ARRAY, id, idx, access, has_values ? &value : NULL);
+    }
+  }
+}
+
+// A watched access asked to stop; do so before the next instruction, as a breakpoint would.
+void cHardware::StopAtWatch()
+{
+  watch_stop = false;
+  if (halt_type != HALT_NONE || IP < 0 || IP >= GetNumInsts()) return;
+  break_IP = IP;
+  resume_IP = -1;
+  Halt(HALT_BREAK);
+  (*this) << "Reached a watchpoint.  Halting." << '\n';
+}
+
+
+// Wall-clock time is only sampled every so many steps to keep the cost out of the hot path.
+void cHardware::CheckWallTime()
+{
+  wall_countdown = 1024;
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (wall_started == false) {
+    wall_start = now;
+    wall_started = true;
+    return;
+  }
+  if (std::chrono::duration<double>(now - wall_start).count() >= wall_limit) {
+    Halt(HALT_WALL_TIME);
+    (*this) << "Reached wall-clock limit of " << wall_limit << " seconds.  Halting." << '\n';
+  }
+}
+
+
+bool cHardware::ChargeOutput(int num_bytes)
+{
+  // Once halted, let final status messages through so the reason is always visible.
+  if (output_limit >= 0 && halt_type == HALT_NONE && output_bytes + num_bytes > output_limit) {
+    Halt(HALT_OUTPUT_LIMIT);
+    (*this) << "Reached output limit of " << output_limit << " bytes.  Halting." << '\n';
+    return false;
+  }
+  output_bytes += num_bytes;
+  return true;
+}
+
+
+bool cHardware::ResizeArray(int id, int new_size)
+{
+  cArray & array = array_map[id];
+  const int size_change = new_size - array.GetSize();
+  if (array_limit >= 0 && size_change > 0 && array_elements + size_change > array_limit) {
+    Halt(HALT_ARRAY_LIMIT);
+    (*this) << "Reached array element limit of " << array_limit << ".  Halting." << '\n';
+    return false;
+  }
+  array_elements += size_change;
+  JournalArray(UNDO_ARRAY, id, 0, array);
+  array.Resize(new_size);
+  NoteArrayChange(id);
+  if (Watching(WATCH_ARRAY)) NoteWatchArray(id, WATCH_WRITE, true);
+  return true;
+}
+
+
+bool cHardware::SetArray(int id, const cArray & value)
+{
+  cArray & array = array_map[id];
+  const int size_change = value.GetSize() - array.GetSize();
+  if (array_limit >= 0 && size_change > 0 && array_elements + size_change > array_limit) {
+    Halt(HALT_ARRAY_LIMIT);
+    (*this) << "Reached array element limit of " << array_limit << ".  Halting." << '\n';
+    return false;
+  }
+  array_elements += size_change;
+  JournalArray(UNDO_ARRAY, id, 0, array);
+  array = value;
+  NoteArrayChange(id);
+  if (Watching(WATCH_ARRAY)) NoteWatchArray(id, WATCH_WRITE, true);
+  return true;
+}
+
+
+// Prepare array id to be overwritten in bulk: resize it (within the element limit), record it once
+// for undo, and return its elements.  Returns NULL if the element limit was reached.
+cVar * cHardware::EditArray(int id, int new_size)
+{
+  cArray & array = array_map[id];
+  const int size_change = new_size - array.GetSize();
+  if (array_limit >= 0 && size_change > 0 && array_elements + size_change > array_limit) {
+    Halt(HALT_ARRAY_LIMIT);
+    (*this) << "Reached array element limit of " << array_limit << ".  Halting." << '\n';
+    return NULL;
+  }
+  array_elements += size_change;
+  JournalArray(UNDO_ARRAY, id, 0, array);
+  array.Resize(new_size);
+  NoteArrayChange(id);
+  if (Watching(WATCH_ARRAY)) NoteWatchArray(id, WATCH_WRITE, false);  // Not yet written.
+  return array.EditData();
+}
+
+
+bool cHardware::CheckMemRange(int start, int count)
+{
+  if (count < 0) {
+    Abort("Cannot use a negative count of memory positions");
+    return false;
+  }
+  if (start < 0) {
+    Abort("Cannot index into a negative memory position");
+    return false;
+  }
+  if ((long long) start + count > (long long) mem_array.size()) {
+    std::stringstream ss;
+    ss << "Limit of " << mem_array.size() << " memory positions available.";
+    Abort(ss.str());
+    return false;
+  }
+  return true;
+}
+
+// Mark every page in a range as used (and extend max_mem_set), checking the page limit before
+// anything is written.  Newly claimed pages are journaled so that undo releases them again.
+bool cHardware::ClaimMemPages(int start, int count)
+{
+  if (count == 0) return true;
+  const int first_page = start >> MEM_PAGE_BITS;
+  const int last_page = (start + count - 1) >> MEM_PAGE_BITS;
+
+  int new_pages = 0;
+  for (int page = first_page; page <= last_page; page++) if (mem_page_used[page] == false) new_pages++;
+  if (mem_page_limit >= 0 && mem_pages_used + new_pages > mem_page_limit) {
+    Halt(HALT_MEM_LIMIT);
+    (*this) << "Reached memory page limit of " << mem_page_limit << ".  Halting." << '\n';
+    return false;
+  }
+
+  for (int page = first_page; page <= last_page; page++) {
+    if (mem_page_used[page] == true) continue;
+    const int pos = std::max(start, page << MEM_PAGE_BITS);
+    Journal(UNDO_MEM, pos, page, mem_array[pos]);
+    mem_page_used[page] = true;
+  }
+  mem_pages_used += new_pages;
+  if (start + count - 1 > max_mem_set) max_mem_set = start + count - 1;
+  return true;
+}
+
+// Per-position bookkeeping for a bulk write; only needed for undo, loop checks, or change tracking.
+void cHardware::RecordMemWrite(int pos, tValue value)
+{
+  Journal(UNDO_MEM, pos, -1, mem_array[pos]);
+  if (loop_check_freq > 0) state_hash ^= HashCell(1, pos, mem_array[pos]) ^ HashCell(1, pos, value);
+  NoteMemChange(pos);
+}
+
+void cHardware::FillMem(int start, int count, tValue value)
+{
+  if (!CheckMemRange(start, count)) return;
+  if (ClaimMemPages(start, count) == false) return;
+
+  if (undo_limit > 0 || loop_check_freq > 0 || track_changes) {
+    for (int pos = start; pos < start + count; pos++) RecordMemWrite(pos, value);
+  }
+  mem_array.Fill(start, count, value);
+  if (Watching(WATCH_MEM)) NoteWatchMem(start, count, WATCH_WRITE);
+}
+
+void cHardware::CopyMem(int from, int to, int count)
+{
+  if (!CheckMemRange(from, count) || !CheckMemRange(to, count)) return;
+  if (ClaimMemPages(to, count) == false) return;
+
+  // Memory has not been changed yet, so source values are still the originals.
+  if (undo_limit > 0 || loop_check_freq > 0 || track_changes) {
+    for (int i = 0; i < count; i++) RecordMemWrite(to + i, mem_array[from + i]);
+  }
+  if (Watching(WATCH_MEM)) NoteWatchMem(from, count, WATCH_READ);
+  mem_array.Move(from, to, count);
+  if (Watching(WATCH_MEM)) NoteWatchMem(to, count, WATCH_WRITE);
+}
+
+void cHardware::SetLoopCheck(int _freq)
+{
+  loop_check_freq = (_freq > 0) ? _freq : 0;
+  loop_jump_count = 0;
+  loop_check_count = 0;
+  loop_next_save = 1;
+
+  // Rebuild the incremental hash from scratch, since writes were not being tracked until now.
+  state_hash = 0;
+  for (auto var_it = var_map.begin(); var_it != var_map.end(); var_it++) {
+    state_hash ^= HashCell(0, var_it->first, var_it->second.AsFloat());
+  }
+  for (int i = 0; i <= max_mem_set; i++) state_hash ^= HashCell(1, i, mem_array[i]);
+}
+
+
+// Combine the incrementally maintained hash with the parts of the state that are cheaper to
+// hash on demand than to track on every write (IP, arrays, and the stack).
+unsigned long long cHardware::CalcStateHash()
+{
+  unsigned long long hash = state_hash ^ HashMix((unsigned int) IP);
+
+  for (auto ar_it = array_map.begin(); ar_it != array_map.end(); ar_it++) {
+    const cArray & array = ar_it->second;
+    if (array.GetSize() == 0) continue;
+    unsigned long long ar_hash = HashMix(((unsigned long long) (unsigned int) ar_it->first << 32) | (unsigned int) array.GetSize());
+    for (int i = 0; i < array.GetSize(); i++) {
+      ar_hash = HashMix(ar_hash ^ ValueBits(array.GetIndex(i)));
+    }
+    hash ^= ar_hash;
+  }
+
+  unsigned long long stack_hash = HashMix(exe_stack.size());
+  for (int i = 0; i < (int) exe_stack.size(); i++) {
+    cStackEntry & entry = *exe_stack[i];
+    if (entry.IsArray()) {
+      const cArray & array = entry.AsArray();
+      stack_hash = HashMix(stack_hash ^ (0x100000000ULL | (unsigned int) array.GetSize()));
+      for (int j = 0; j < array.GetSize(); j++) {
+        stack_hash = HashMix(stack_hash ^ ValueBits(array.GetIndex(j)));
+      }
+    }
+    else stack_hash = HashMix(stack_hash ^ ValueBits(entry.AsFloat()));
+  }
+
+  unsigned long long call_hash = HashMix(call_stack.size() ^ 0x5ca11ULL);
+  for (int i = 0; i < (int) call_stack.size(); i++) {
+    call_hash = HashMix(call_hash ^ (unsigned int) call_stack[i]);
+  }
+
+  unsigned long long random_hash = 0;
+  for (int i = 0; i < random.GetStateSize(); i++) {
+    random_hash = HashMix(random_hash ^ (unsigned int) random.GetStateWord(i));
+  }
+
+  return hash ^ stack_hash ^ call_hash ^ random_hash;
+}
+
+
+static bool SameArray(const cArray & ar1, const cArray & ar2)
+{
+  if (ar1.GetSize() != ar2.GetSize()) return false;
+  for (int i = 0; i < ar1.GetSize(); i++) {
+    tValue v1 = ar1.GetIndex(i), v2 = ar2.GetIndex(i);
+    if (memcmp(&v1, &v2, sizeof(tValue)) != 0) return false;
+  }
+  return true;
+}
+
+
+void cHardware::SaveLoopSnapshot(unsigned long long hash)
+{
+  loop_snapshot.hash = hash;
+  loop_snapshot.IP = IP;
+
+  loop_snapshot.vars.clear();
+  for (auto var_it = var_map.begin(); var_it != var_map.end(); var_it++) {
+    if (ValueBits(var_it->second.AsFloat()) == 0) continue;
+    loop_snapshot.vars.push_back(std::make_pair(var_it->first, var_it->second.AsFloat()));
+  }
+
+  loop_snapshot.mem = mem_array;
+
+  loop_snapshot.arrays.clear();
+  for (auto ar_it = array_map.begin(); ar_it != array_map.end(); ar_it++) {
+    if (ar_it->second.GetSize() > 0) loop_snapshot.arrays[ar_it->first] = ar_it->second;
+  }
+
+  loop_snapshot.stack.clear();
+  for (int i = 0; i < (int) exe_stack.size(); i++) loop_snapshot.stack.push_back(*exe_stack[i]);
+  loop_snapshot.call_stack = call_stack;
+
+  loop_snapshot.random = random;
+}
+
+
+// Do a full, exact comparison between the current state and the saved snapshot.
+bool cHardware::MatchLoopSnapshot()
+{
+  if (IP != loop_snapshot.IP) return false;
+
+  for (int i = 0; i < random.GetStateSize(); i++) {
+    if (random.GetStateWord(i) != loop_snapshot.random.GetStateWord(i)) return false;
+  }
+
+  int var_id = 0;
+  for (auto var_it = var_map.begin(); var_it != var_map.end(); var_it++) {
+    if (ValueBits(var_it->second.AsFloat()) == 0) continue;
+    if (var_id >= (int) loop_snapshot.vars.size()) return false;
+    if (loop_snapshot.vars[var_id].first != var_it->first) return false;
+    if (ValueBits(loop_snapshot.vars[var_id].second) != ValueBits(var_it->second.AsFloat())) return false;
+    var_id++;
+  }
+  if (var_id != (int) loop_snapshot.vars.size()) return false;
+
+  if (!mem_array.SameAs(loop_snapshot.mem)) return false;
+
+  auto snap_it = loop_snapshot.arrays.begin();
+  for (auto ar_it = array_map.begin(); ar_it != array_map.end(); ar_it++) {
+    if (ar_it->second.GetSize() == 0) continue;
+    if (snap_it == loop_snapshot.arrays.end() || snap_it->first != ar_it->first) return false;
+    if (!SameArray(snap_it->second, ar_it->second)) return false;
+    snap_it++;
+  }
+  if (snap_it != loop_snapshot.arrays.end()) return false;
+
+  if (exe_stack.size() != loop_snapshot.stack.size()) return false;
+  for (int i = 0; i < (int) exe_stack.size(); i++) {
+    cStackEntry & entry = *exe_stack[i];
+    cStackEntry & snap_entry = loop_snapshot.stack[i];
+    if (entry.IsArray() != snap_entry.IsArray()) return false;
+    if (entry.IsArray() && !SameArray(entry.AsArray(), snap_entry.AsArray())) return false;
+    if (!entry.IsArray() && ValueBits(entry.AsFloat()) != ValueBits(snap_entry.AsFloat())) return false;
+  }
+  if (call_stack != loop_snapshot.call_stack) return false;
+
+  return true;
+}
+
+
+// Brent-style cycle detection over the states seen at each check: compare against a single saved
+// snapshot, and take a fresh one whenever the number of checks reaches the next power of two.
+void cHardware::CheckLoop()
+{
+  if (halt_type != HALT_NONE) return;
+
+  const unsigned long long hash = CalcStateHash();
+  loop_check_count++;
+
+  if (loop_check_count > 1 && hash == loop_snapshot.hash && MatchLoopSnapshot()) {
+    (*this) << "Non-terminating program detected (state repeated at IP " << IP << ").  Halting." << '\n';
+    Halt(HALT_LOOP);
+    return;
+  }
+
+  if (loop_check_count == loop_next_save) {
+    SaveLoopSnapshot(hash);
+    loop_next_save *= 2;
+  }
+}
+
+
+// Helpers for reading and writing snapshot fields.
+static void WriteInt(std::ostream & out, int value) { out.write((const char *) &value, sizeof(value)); }
+static void WriteFloat(std::ostream & out, tValue value) { out.write((const char *) &value, sizeof(value)); }
+static void WriteFloats(std::ostream & out, const tValue * values, int count) {
+  out.write((const char *) values, count * sizeof(tValue));
+}
+static int ReadInt(std::istream & in) { int value = 0; in.read((char *) &value, sizeof(value)); return value; }
+static tValue ReadFloat(std::istream & in) { tValue value = 0; in.read((char *) &value, sizeof(value)); return value; }
+
+// Snapshots hold values in their native form, so each value type has its own tag.
+#if defined(TUBE_VALUE_DOUBLE)
+static const char snapshot_magic[] = "TUBSNP3D";
+#elif defined(TUBE_VALUE_INT)
+static const char snapshot_magic[] = "TUBSNP3I";
+#else
+static const char snapshot_magic[] = "TUBESNP3";
+#endif
+
+static void WriteArray(std::ostream & out, const cArray & array)
+{
+  WriteInt(out, array.GetSize());
+  for (int i = 0; i < array.GetSize(); i++) WriteFloat(out, array.GetIndex(i));
+}
+
+static bool ReadArray(std::istream & in, cArray & array)
+{
+  const int size = ReadInt(in);
+  if (!in || size < 0) return false;
+  array.Resize(size);
+  for (int i = 0; i < size; i++) array.SetIndex(i, ReadFloat(in));
+  return (bool) in;
+}
+
+
+unsigned long long cHardware::GetProgramHash()
+{
+  const std::vector<cInst_Base *> & inst_vector = program->inst_vector;
+  unsigned long long hash = HashMix(inst_vector.size());
+  for (int i = 0; i < (int) inst_vector.size(); i++) {
+    std::string inst_str = inst_vector[i]->GetName();
+    for (int arg_id = 0; arg_id < 3; arg_id++) {
+      inst_str += ' ';
+      inst_str += inst_vector[i]->GetArgString(arg_id);
+    }
+    if (inst_vector[i]->GetArg4() != NULL) {
+      inst_str += ' ';
+      inst_str += inst_vector[i]->GetArg4String();
+    }
+    for (int pos = 0; pos < (int) inst_str.size(); pos++) hash = HashMix(hash ^ (unsigned char) inst_str[pos]);
+  }
+  return hash;
+}
+
+unsigned long long cHardware::GetRunHash()
+{
+  unsigned long long hash = HashMix(GetProgramHash() ^ HashMix(exe_count));
+
+  // Registers, scalars and memory are rehashed here since state_hash is only kept up to date
+  // while loop checks are on; CalcStateHash() adds the rest of the state.
+  for (auto var_it = var_map.begin(); var_it != var_map.end(); var_it++) {
+    hash ^= HashCell(0, var_it->first, var_it->second.AsFloat());
+  }
+  for (int pos = 0; pos <= max_mem_set; pos++) hash ^= HashCell(1, pos, mem_array[pos]);
+  hash ^= CalcStateHash() ^ state_hash;
+
+  cRandom next_random(random);
+
+  // Everything that can change what a run prints or where it stops (except the wall clock).
+  const long long settings[] = { seed, next_random.Next(), timeout, count_cycles, array_limit, stack_limit,
+                                 call_limit, output_limit, mem_page_limit, loop_check_freq };
+  for (int i = 0; i < (int) (sizeof(settings) / sizeof(settings[0])); i++) {
+    hash = HashMix(hash ^ (unsigned long long) settings[i]);
+  }
+  return hash;
+}
+
+
+bool cHardware::SaveState(std::ostream & out)
+{
+  out.write(snapshot_magic, 8);
+  const unsigned long long program_hash = GetProgramHash();
+  out.write((const char *) &program_hash, sizeof(program_hash));
+
+  WriteInt(out, IP);
+  WriteInt(out, exe_count);
+  WriteInt(out, halt_type);
+  WriteInt(out, break_IP);    // Needed to continue a checkpoint taken at a breakpoint stop.
+  WriteInt(out, resume_IP);
+
+  WriteInt(out, (int) var_map.size());
+  for (auto var_it = var_map.begin(); var_it != var_map.end(); var_it++) {
+    WriteInt(out, var_it->first);
+    WriteFloat(out, var_it->second.AsFloat());
+  }
+
+  // Empty arrays are indistinguishable from ones never used, so they are skipped.
+  int num_arrays = 0;
+  for (auto ar_it = array_map.begin(); ar_it != array_map.end(); ar_it++) {
+    if (ar_it->second.GetSize() > 0) num_arrays++;
+  }
+  WriteInt(out, num_arrays);
+  for (auto ar_it = array_map.begin(); ar_it != array_map.end(); ar_it++) {
+    if (ar_it->second.GetSize() == 0) continue;
+    WriteInt(out, ar_it->first);
+    WriteArray(out, ar_it->second);
+  }
+
+  WriteInt(out, (int) exe_stack.size());
+  for (int i = 0; i < (int) exe_stack.size(); i++) {
+    WriteInt(out, exe_stack[i]->IsArray());
+    if (exe_stack[i]->IsArray()) WriteArray(out, exe_stack[i]->AsArray());
+    else WriteFloat(out, exe_stack[i]->AsFloat());
+  }
+
+  WriteInt(out, (int) call_stack.size());
+  for (int i = 0; i < (int) call_stack.size(); i++) WriteInt(out, call_stack[i]);
+
+  // Memory beyond max_mem_set has never been written, so only the used prefix is saved.
+  WriteInt(out, max_mem_set);
+  for (int i = 0; i <= max_mem_set; i += cMemory::PAGE_SIZE) {
+    tValue page_buf[cMemory::PAGE_SIZE];
+    const int count = std::min(cMemory::PAGE_SIZE, max_mem_set + 1 - i);
+    for (int j = 0; j < count; j++) page_buf[j] = mem_array[i+j];
+    WriteFloats(out, page_buf, count);
+  }
+  for (int i = 0; i < (int) mem_page_used.size(); i++) out.put(mem_page_used[i] ? 1 : 0);
+
+  const std::string output = iout.str();
+  out.write((const char *) &output_bytes, sizeof(output_bytes));
+  WriteInt(out, (int) output.size());
+  out.write(output.c_str(), output.size());
+
+  for (int i = 0; i < random.GetStateSize(); i++) WriteInt(out, random.GetStateWord(i));
+
+  return (bool) out;
+}
+
+
+bool cHardware::LoadState(std::istream & in)
+{
+  char magic[8];
+  in.read(magic, 8);
+  if (!in || memcmp(magic, snapshot_magic, 8) != 0) {
+    Error("Snapshot is not in a recognized format.");
+    return false;
+  }
+  unsigned long long program_hash = 0;
+  in.read((char *) &program_hash, sizeof(program_hash));
+  if (program_hash != GetProgramHash()) {
+    Error("Snapshot was saved from a different program.");
+    return false;
+  }
+
+  Restart();
+
+  IP = ReadInt(in);
+  exe_count = ReadInt(in);
+  halt_type = ReadInt(in);
+  break_IP = ReadInt(in);
+  resume_IP = ReadInt(in);
+  const int num_insts = (int) program->inst_vector.size();
+  if (break_IP < -1 || break_IP >= num_insts || resume_IP < -1 || resume_IP >= num_insts) {
+    Error("Snapshot is corrupt.");
+    Restart();
+    return false;
+  }
+
+  const int num_vars = ReadInt(in);
+  for (int i = 0; i < num_vars && in; i++) {
+    const int var_id = ReadInt(in);
+    var_map[var_id].Set(ReadFloat(in));
+  }
+
+  const int num_arrays = ReadInt(in);
+  for (int i = 0; i < num_arrays && in; i++) {
+    const int array_id = ReadInt(in);
+    cArray & array = array_map[array_id];
+    if (!::ReadArray(in, array)) break;
+    array_elements += array.GetSize();
+  }
+
+  const int stack_size = ReadInt(in);
+  for (int i = 0; i < stack_size && in; i++) {
+    if (ReadInt(in)) {
+      cArray array;
+      if (!::ReadArray(in, array)) break;
+      array_elements += array.GetSize();
+      exe_stack.push_back(new cStackEntry(array));
+    }
+    else exe_stack.push_back(new cStackEntry(ReadFloat(in)));
+  }
+
+  const int call_depth = ReadInt(in);
+  for (int i = 0; i < call_depth && in; i++) call_stack.push_back(ReadInt(in));
+
+  max_mem_set = ReadInt(in);
+  if (!in || max_mem_set < 0 || max_mem_set >= (int) mem_array.size()) {
+    Error("Snapshot is corrupt.");
+    Restart();
+    return false;
+  }
+  for (int i = 0; i <= max_mem_set; i++) {
+    const tValue value = ReadFloat(in);
+    if (ValueBits(value) != 0) mem_array.Set(i, value);
+  }
+  for (int i = 0; i < (int) mem_page_used.size(); i++) {
+    mem_page_used[i] = (in.get() == 1);
+    if (mem_page_used[i]) mem_pages_used++;
+  }
+
+  in.read((char *) &output_bytes, sizeof(output_bytes));
+  const int output_size = ReadInt(in);
+  if (!in || output_size < 0) {
+    Error("Snapshot is corrupt.");
+    Restart();
+    return false;
+  }
+  std::string output(output_size, '\0');
+  if (output_size > 0) in.read(&output[0], output_size);
+  iout << output;
+
+  for (int i = 0; i < random.GetStateSize(); i++) random.SetStateWord(i, ReadInt(in));
+
+  if (!in) {
+    Error("Snapshot is truncated.");
+    Restart();
+    return false;
+  }
+
+  SetLoopCheck(loop_check_freq);  // Rebuild the loop-detection hash for the restored state.
+  return true;
+}
+
+
+bool cHardware::SaveStateFile(const std::string & filename)
+{
+  // Write to a temporary file first so that a crash mid-write never clobbers the last checkpoint.
+  const std::string tmp_filename = filename + ".tmp";
+  std::ofstream out(tmp_filename.c_str(), std::ios::binary);
+  if (!out || !SaveState(out)) {
+    Error(std::string("Unable to write checkpoint '") + filename + "'.");
+    return false;
+  }
+  out.close();
+  if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    Error(std::string("Unable to write checkpoint '") + filename + "'.");
+    return false;
+  }
+  return true;
+}
+
+
+bool cHardware::LoadStateFile(const std::string & filename)
+{
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  if (!in) {
+    Error(std::string("Unable to open checkpoint '") + filename + "'.");
+    return false;
+  }
+  return LoadState(in);
+}
+
+
+void cHardware::DropOldestUndoStep()
+{
+  const long long next_first = (undo_steps.size() > 1) ? undo_steps[1].first_entry : undo_base + undo_entries.size();
+  while (undo_base < next_first) {
+    undo_entries.pop_front();
+    undo_base++;
+  }
+  undo_steps.pop_front();
+}
+
+
+void cHardware::SetUndoLimit(int _steps)
+{
+  undo_limit = (_steps > 0) ? _steps : 0;
+  while ((int) undo_steps.size() > undo_limit) DropOldestUndoStep();
+}
+
+
+// Record the state that each step may change as a whole, dropping the oldest step if full.
+void cHardware::JournalStep()
+{
+  if ((int) undo_steps.size() >= undo_limit) DropOldestUndoStep();
+
+  cUndoStep step;
+  step.first_entry = undo_base + undo_entries.size();
+  step.IP = IP;
+  step.exe_count = exe_count;
+  step.halt_type = halt_type;
+  step.max_mem_set = max_mem_set;
+  step.mem_pages_used = mem_pages_used;
+  step.array_elements = array_elements;
+  step.output_bytes = output_bytes;
+  step.output_size = print_internal ? (long long) iout.tellp() : 0;
+  undo_steps.push_back(step);
+}
+
+
+void cHardware::UndoEntry(const cUndoEntry & entry)
+{
+  switch (entry.type) {
+  case UNDO_VAR: {
+    cVar & var = var_map[entry.id];
+    if (loop_check_freq > 0) state_hash ^= HashCell(0, entry.id, var.AsFloat()) ^ HashCell(0, entry.id, entry.value);
+    if (entry.index) var.Set(entry.value);
+    else var_map.erase(entry.id);
+    NoteVarChange(entry.id);
+    break;
+  }
+  case UNDO_MEM:
+    if (loop_check_freq > 0) state_hash ^= HashCell(1, entry.id, mem_array[entry.id]) ^ HashCell(1, entry.id, entry.value);
+    mem_array.Set(entry.id, entry.value);
+    if (entry.index >= 0) mem_page_used[entry.index] = false;
+    NoteMemChange(entry.id);
+    break;
+  case UNDO_ARRAY_IDX:
+    array_map[entry.id].SetIndex(entry.index, entry.value);
+    NoteArrayChange(entry.id);
+    break;
+  case UNDO_ARRAY:
+    array_map[entry.id] = entry.array;
+    NoteArrayChange(entry.id);
+    break;
+  case UNDO_PUSH:
+    delete exe_stack.back();
+    exe_stack.pop_back();
+    break;
+  case UNDO_POP:
+    if (entry.index) exe_stack.push_back(new cStackEntry(entry.array));
+    else exe_stack.push_back(new cStackEntry(entry.value));
+    break;
+  case UNDO_RANDOM:
+    random.Rewind(entry.index);
+    break;
+  case UNDO_CALL:
+    call_stack.pop_back();
+    break;
+  case UNDO_RETURN:
+    call_stack.push_back(entry.id);
+    break;
+  }
+}
+
+
+bool cHardware::StepBack()
+{
+  if (undo_steps.size() == 0) return false;
+
+  const cUndoStep & step = undo_steps.back();
+  while (undo_base + (long long) undo_entries.size() > step.first_entry) {
+    UndoEntry(undo_entries.back());
+    undo_entries.pop_back();
+  }
+
+  IP = step.IP;
+  advance_IP = false;
+  exe_count = step.exe_count;
+  halt_type = step.halt_type;
+  break_IP = resume_IP = -1;
+  max_mem_set = step.max_mem_set;
+  mem_pages_used = step.mem_pages_used;
+  array_elements = step.array_elements;
+  output_bytes = step.output_bytes;
+  if (print_internal && (long long) iout.tellp() > step.output_size) {
+    std::string output = iout.str();
+    output.resize(step.output_size);
+    iout.str(output);
+    iout.seekp(0, std::ios::end);
+    if (step.output_size < changes.output_start) changes.full = true;  // Output can't be patched.
+  }
+  undo_steps.pop_back();
+
+  // States are about to be revisited, which must not be mistaken for an infinite loop.
+  loop_jump_count = 0;
+  jumped_back = false;
+  loop_check_count = 0;
+  loop_next_save = 1;
+
+  return true;
+}
+
+
+bool cHardware::RunBackTo(int target_IP)
+{
+  while (StepBack()) {
+    if (IP == target_IP) return true;
+  }
+  return false;
+}
+
+
+cHardware * cHardware::Fork()
+{
+  cHardware * fork = new cHardware();
+  fork->program = program;
+  fork->var_map = var_map;
+  fork->array_map = array_map;
+  fork->mem_array = mem_array;
+  fork->max_mem_set = max_mem_set;
+  for (int i = 0; i < (int) exe_stack.size(); i++) fork->exe_stack.push_back(new cStackEntry(*exe_stack[i]));
+  fork->call_stack = call_stack;
+
+  fork->IP = IP;
+  fork->advance_IP = advance_IP;
+  fork->exe_count = exe_count;
+  fork->timeout = timeout;
+  fork->random = random;
+  fork->seed = seed;
+
+  fork->print_to_console = print_to_console;
+  fork->print_internal = print_internal;
+  fork->iout << iout.str();
+  fork->count_cycles = count_cycles;
+  fork->halt_type = halt_type;
+  fork->break_IP = break_IP;
+  fork->resume_IP = resume_IP;
+
+  fork->wall_limit = wall_limit;
+  fork->array_limit = array_limit;
+  fork->array_elements = array_elements;
+  fork->stack_limit = stack_limit;
+  fork->call_limit = call_limit;
+  fork->output_limit = output_limit;
+  fork->output_bytes = output_bytes;
+  fork->mem_page_limit = mem_page_limit;
+  fork->mem_pages_used = mem_pages_used;
+  fork->mem_page_used = mem_page_used;
+  fork->watchpoints = watchpoints;
+  fork->watch_targets = watch_targets;
+  fork->mem_page_watched = mem_page_watched;
+
+  // The fork has no history of its own, so loop checks and undo start fresh.
+  fork->loop_check_freq = loop_check_freq;
+  fork->state_hash = state_hash;
+  fork->undo_limit = undo_limit;
+
+  return fork;
+}
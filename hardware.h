@@ -1,83 +1,318 @@
 #ifndef HARDWARE_H
 #define HARDWARE_H
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <deque>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <set>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <sstream>
 #include <time.h>
 #include <vector>
 
+#include "arena.h"
+#include "format.h"
 #include "inst.h"
 
+// Reasons that execution may have come to a halt.
+enum HaltType { HALT_NONE=0, HALT_END, HALT_TIMEOUT, HALT_LOOP,
+                HALT_WALL_TIME, HALT_ARRAY_LIMIT, HALT_STACK_LIMIT, HALT_OUTPUT_LIMIT, HALT_MEM_LIMIT,
+                HALT_CALL_STACK, HALT_BREAK, HALT_ERROR };
+
+// Watchpoints report (and optionally stop at) reads and writes of memory positions, registers or
+// scalars, and array elements.
+enum WatchAccess { WATCH_READ=1, WATCH_WRITE=2 };
+enum WatchTarget { WATCH_MEM=0, WATCH_VAR, WATCH_ARRAY };
+
+struct cWatchpoint {
+  std::string name;   // As given, for reports on variables.
+  int target;         // What is watched (see WatchTarget).
+  int id;             // Variable or array watched.
+  int start;          // First memory position or array index watched.
+  int count;          // Number of memory positions or array indices watched.
+  int access;         // Accesses reported (see WatchAccess).
+  bool stop;          // Stop after the instruction making the access?
+
+  bool Covers(int _target, int _id, int pos) const {
+    return _target == target && _id == id && pos >= start && pos < start + count;
+  }
+};
+
+// Additive-feedback generator matching glibc's rand(), kept inside the hardware so that its
+// state can be hashed, saved, and restored along with everything else.
+class cRandom {
+private:
+  static const int STATE_SIZE = 31;
+  static const int STATE_SEP = 3;
+  int state[STATE_SIZE];
+  int front;   // Position of the leading tap in state.
+  int rear;    // Position of the trailing tap in state.
+public:
+  cRandom(unsigned int seed=1) { Seed(seed); }
+  ~cRandom() { ; }
+
+  void Seed(unsigned int seed) {
+    if (seed == 0) seed = 1;
+    state[0] = (int) seed;
+    for (int i = 1; i < STATE_SIZE; i++) {
+      const int hi = state[i-1] / 127773;
+      const int lo = state[i-1] % 127773;
+      int word = 16807 * lo - 2836 * hi;
+      if (word < 0) word += 2147483647;
+      state[i] = word;
+    }
+    front = STATE_SEP;
+    rear = 0;
+    for (int i = 0; i < 10 * STATE_SIZE; i++) Next();
+  }
+
+  int Next() {
+    unsigned int val = (unsigned int) state[front] + (unsigned int) state[rear];
+    state[front] = (int) val;
+    if (++front == STATE_SIZE) front = 0;
+    if (++rear == STATE_SIZE) rear = 0;
+    return (int) (val >> 1);
+  }
+
+  // Reverse the most recent Next(), given the value that the leading tap held before it.
+  void Rewind(int prev_word) {
+    if (--front < 0) front = STATE_SIZE - 1;
+    if (--rear < 0) rear = STATE_SIZE - 1;
+    state[front] = prev_word;
+  }
+
+  int GetFront() const { return front; }
+  int GetStateSize() const { return STATE_SIZE + 2; }
+  int GetStateWord(int id) const {
+    if (id < STATE_SIZE) return state[id];
+    return (id == STATE_SIZE) ? front : rear;
+  }
+  void SetStateWord(int id, int value) {
+    if (id < STATE_SIZE) state[id] = value;
+    else if (id == STATE_SIZE) front = value;
+    else rear = value;
+  }
+};
+
 class cVar {
 private:
-  // union VarVals {
-  //   int i;
-  //   float f;
-  // } value;
-  float value;
+  tValue value;
 public:
   cVar() { value = 0.0; }
   cVar(const cVar & _in) { value = _in.value; }
   ~cVar() { ; }
 
-  int AsInt() const { return (int) value; }
-  float AsFloat() const { return value; }
+  tInt AsInt() const { return (tInt) value; }
+  tValue AsFloat() const { return value; }
 
-  void Set(int _v) { value = (float) _v; }
-  void Set(float _v) { value = _v; }
+  void Set(int _v) { value = (tValue) _v; }
+  void Set(tValue _v) { value = _v; }
 };
 
+// Arrays are copy-on-write: copies share their data until one of them is changed.
 class cArray {
 private:
-  std::vector<cVar> array_data;
+  std::shared_ptr<std::vector<cVar> > array_data;
+
+  std::vector<cVar> & Unshare() {
+    if (!array_data) array_data = std::make_shared<std::vector<cVar> >();
+    else if (array_data.use_count() > 1) array_data = std::make_shared<std::vector<cVar> >(*array_data);
+    return *array_data;
+  }
 public:
   cArray() { ; }
-  cArray(const cArray & _in) { array_data = _in.array_data; }
+  cArray(const cArray & _in) : array_data(_in.array_data) { ; }
   ~cArray() { ; }
 
   cArray & operator=(const cArray & _in) { array_data = _in.array_data; return *this; }
 
-  int GetSize() const { return (int) array_data.size(); }
-  float GetIndex(int idx) const { return array_data[idx].AsFloat(); }
+  int GetSize() const { return array_data ? (int) array_data->size() : 0; }
+  tValue GetIndex(int idx) const { return (*array_data)[idx].AsFloat(); }
+
+  void SetIndex(int idx, tValue value) { Unshare()[idx].Set(value); }
 
-  void SetIndex(int idx, float value) { array_data[idx].Set(value); }
-  void Resize(int new_size) { array_data.resize(new_size); }
+  // Direct access to the elements, for bulk operations.
+  const cVar * GetData() const { return array_data ? array_data->data() : NULL; }
+  cVar * EditData() { return Unshare().data(); }
+  void Resize(int new_size) {
+    if (new_size == GetSize()) return;
+    Unshare().resize(new_size);
+  }
+};
+
+// Main memory, stored as copy-on-write pages; pages never written share a single zero page.
+class cMemory {
+public:
+  static const int PAGE_BITS = 10;
+  static const int PAGE_SIZE = 1 << PAGE_BITS;
+  static const int PAGE_MASK = PAGE_SIZE - 1;
+private:
+  typedef std::vector<tValue> tPage;
+  std::vector<std::shared_ptr<tPage> > pages;
+
+  static const std::shared_ptr<tPage> & ZeroPage() {
+    static const std::shared_ptr<tPage> zero_page = std::make_shared<tPage>(PAGE_SIZE, 0.0f);
+    return zero_page;
+  }
+  tPage & MutablePage(int page_id) {
+    std::shared_ptr<tPage> & page = pages[page_id];
+    if (page.use_count() > 1) page = std::make_shared<tPage>(*page);
+    return *page;
+  }
+public:
+  cMemory(int size) : pages((size + PAGE_MASK) >> PAGE_BITS, ZeroPage()) { ; }
+  cMemory(const cMemory & _in) : pages(_in.pages) { ; }
+  ~cMemory() { ; }
+
+  cMemory & operator=(const cMemory & _in) { pages = _in.pages; return *this; }
+
+  int size() const { return (int) pages.size() << PAGE_BITS; }
+  int GetNumPages() const { return (int) pages.size(); }
+  tValue operator[](int pos) const { return (*pages[pos >> PAGE_BITS])[pos & PAGE_MASK]; }
+
+  void Set(int pos, tValue value) { MutablePage(pos >> PAGE_BITS)[pos & PAGE_MASK] = value; }
+  void Clear() { pages.assign(pages.size(), ZeroPage()); }
+
+  // Bulk operations over [pos, pos+count), working a page at a time; ranges must already be in bounds.
+  void Fill(int pos, int count, tValue value);
+  void Move(int from, int to, int count);
+  tValue Sum(int pos, int count) const;
+  int Compare(int pos1, int pos2, int count) const;
+
+  // Bitwise comparison; shared pages are known to match without looking at them.
+  bool SameAs(const cMemory & _in) const {
+    if (pages.size() != _in.pages.size()) return false;
+    for (int i = 0; i < (int) pages.size(); i++) {
+      if (pages[i] == _in.pages[i]) continue;
+      if (memcmp(&(*pages[i])[0], &(*_in.pages[i])[0], PAGE_SIZE * sizeof(tValue)) != 0) return false;
+    }
+    return true;
+  }
+};
+
+// The instructions and labels of a loaded program, shared between forked hardware.
+class cProgram {
+public:
+  std::map<std::string,int> label_map;    // Tracking positions of all labels in the source file.
+  std::vector<cInst_Base *> inst_vector;
+  std::vector<std::string> imports;       // Paths of modules to link in after parsing (see module.h).
+  std::shared_ptr<cArena> arena;          // Owns the instructions, their arguments, and label names.
+  bool labels_reused;                     // Has any label been defined more than once?
+  std::map<cInst_Base *, cInst_BREAK *> spare_traps;   // Cleared traps, by the instruction they were on.
+  int dead_insts;                         // Instructions replaced, but still taking room in the arena.
+
+  cProgram() : arena(std::make_shared<cArena>()), labels_reused(false), dead_insts(0) { ; }
 };
 
 class cStackEntry {
 private:
-  float value;
+  tValue value;
   cArray ar_value;
   bool is_array;
 public:
-  cStackEntry(float _v) : value(_v), is_array(false) { ; }
+  cStackEntry(tValue _v) : value(_v), is_array(false) { ; }
   cStackEntry(const cArray & _v) : ar_value(_v), is_array(true) { ; }
   ~cStackEntry() { ; }
 
-  float AsFloat() { return value; }
+  tValue AsFloat() { return value; }
   const cArray & AsArray() { return ar_value; }
   bool IsArray() { return is_array; }
 };
 
+// Types of changes recorded in the undo journal.
+enum UndoType { UNDO_VAR=0, UNDO_MEM, UNDO_ARRAY_IDX, UNDO_ARRAY, UNDO_PUSH, UNDO_POP, UNDO_RANDOM,
+                UNDO_CALL, UNDO_RETURN };
+
+// A single change made by an instruction, holding whatever is needed to reverse it.
+class cUndoEntry {
+public:
+  int type;       // Which kind of change is this? (see UndoType)
+  int id;         // Variable id, memory position, or array id.
+  int index;      // Array index; memory page newly used (or -1); whether a variable existed; etc.
+  tValue value;    // Prior value of the changed cell (or the value popped off the stack).
+  cArray array;   // Prior contents of a whole array (or the array popped off the stack).
+
+  cUndoEntry(int _t, int _id, int _idx, tValue _v) : type(_t), id(_id), index(_idx), value(_v) { ; }
+  cUndoEntry(int _t, int _id, int _idx, const cArray & _a) : type(_t), id(_id), index(_idx), value(0.0), array(_a) { ; }
+};
+
+// Everything about an instruction execution that is restored wholesale rather than per-change.
+class cUndoStep {
+public:
+  long long first_entry;   // Journal position of the first change made by this step.
+  int IP;
+  int exe_count;
+  int halt_type;
+  int max_mem_set;
+  int mem_pages_used;
+  long long array_elements;
+  long long output_bytes;
+  long long output_size;   // Length of the internal output record.
+};
+
+// What has changed since tracking last began, so that displays can redraw only those parts.
+class cChangeSet {
+public:
+  static const int MAX_TRACKED = 256;  // Beyond this many changes, a full redraw is cheaper.
+
+  int old_IP;               // IP when tracking began (the current IP is the new one).
+  std::set<int> vars;       // Registers or scalars written.
+  std::set<int> arrays;     // Arrays resized, replaced, or written into.
+  std::set<int> mem;        // Memory positions written.
+  long long output_start;   // Length of the internal output when tracking began.
+  bool full;                // Too much changed to list; everything should be redrawn.
+
+  cChangeSet() : old_IP(0), output_start(0), full(true) { ; }
+
+  void Note(std::set<int> & ids, int id) {
+    if (full) return;
+    ids.insert(id);
+    if ((int) ids.size() > MAX_TRACKED) full = true;
+  }
+  bool Empty() const { return !full && vars.size() == 0 && arrays.size() == 0 && mem.size() == 0; }
+};
+
+// A full copy of the machine state, used to confirm that a hash match really is a repeated state.
+class cLoopSnapshot {
+public:
+  unsigned long long hash;
+  int IP;
+  std::vector<std::pair<int,tValue> > vars;   // Only non-zero variables are recorded.
+  cMemory mem;                               // Shares pages with the hardware until they change.
+  std::map<int,cArray> arrays;               // Only non-empty arrays are recorded.
+  std::vector<cStackEntry> stack;
+  std::vector<int> call_stack;
+  cRandom random;
+
+  cLoopSnapshot() : mem(0) { ; }
+};
+
 class cHardware {
 private:
-  std::map<std::string,int> label_map;    // Tracking positions of all labels in the source file.
+  std::shared_ptr<cProgram> program;      // Instructions and labels (possibly shared with forks).
   std::map<int,cVar> var_map;
   std::map<int,cArray> array_map;
-  std::vector<cInst_Base *> inst_vector;
-  std::vector<float> mem_array;
+  cMemory mem_array;
   int max_mem_set;                        // Maximum memory value set so far.
 
   std::vector<cStackEntry *> exe_stack;
+  std::vector<int> call_stack;            // Return addresses for call/ret.
+
+  static const int MEM_PAGE_BITS = cMemory::PAGE_BITS;   // Memory is tracked in pages of 1024 positions.
 
   int IP;          // Instruction pointer -- which instruction to be executed?
   bool advance_IP; // Should the instruction pointer be advanced after execution?
 
   int exe_count;   // Number of instructions executed thus far.
   int timeout;     // Maximum number of instructions executed before halting.
+  cRandom random;  // Random number generator used by the random instruction.
+  unsigned int seed; // Seed that the random number generator is reset to on Restart().
 
   bool print_to_console;  // Should string outputs be sent to the cout and console?
   bool print_internal;    // Should printed messages be saved internally?
@@ -85,42 +320,265 @@ private:
   bool count_cycles;      // Should we keep track of how many CPU cycles have been used?
   bool verbose;           // Should we print information about each line executed?
   std::ofstream v_file;   // Verbose file.
+  int halt_type;          // Why did execution stop?  (see HaltType)
+
+  // Breakpoints are patched into the program; when one stops execution, IP is parked at the end
+  // like any other halt, and the next run continues from break_IP.
+  int break_IP;           // Instruction stopped at (-1 if not stopped at a breakpoint).
+  int resume_IP;          // Breakpoint to run through (rather than stop at) when continuing.
+
+  void ContinueFromBreak() {
+    IP = break_IP;
+    break_IP = -1;
+    halt_type = HALT_NONE;
+  }
+
+  // Resource limits (a negative limit means unlimited).
+  double wall_limit;                 // Maximum wall-clock seconds for a run.
+  int wall_countdown;                // Steps until the clock is next checked.
+  bool wall_started;                 // Has the clock been started for this run?
+  std::chrono::steady_clock::time_point wall_start;
+  int array_limit;                   // Maximum total elements across all arrays (including the stack).
+  long long array_elements;          // Current total elements across all arrays.
+  int stack_limit;                   // Maximum depth of exe_stack.
+  int call_limit;                    // Maximum depth of call_stack (overflowing it is a trap).
+  long long output_limit;            // Maximum bytes of output.
+  long long output_bytes;            // Bytes output thus far.
+  int mem_page_limit;                // Maximum number of memory pages written to.
+  int mem_pages_used;                // Number of memory pages written to thus far.
+  std::vector<bool> mem_page_used;   // Which memory pages have been written to?
+
+  // Watchpoints; accesses are only checked for kinds of target that are being watched, and
+  // memory accesses only on pages holding a watched position.
+  std::vector<cWatchpoint> watchpoints;
+  int watch_targets;                 // Bit for each WatchTarget with a watchpoint.
+  std::vector<bool> mem_page_watched;
+  bool watch_stop;                   // Should execution stop after the current instruction?
+
+  bool Watching(int target) const { return (watch_targets >> target) & 1; }
+  void NoteWatch(int target, int id, int pos, int access, const tValue * value);
+  void NoteWatchMem(int start, int count, int access);
+  void NoteWatchArray(int id, int access, bool has_values);
+  void StopAtWatch();
+
+  void CheckWallTime();
+  void EditProgram();
+  void RebuildProgram();
+  void ReclaimProgram();
+
+  // Editing in place (see BeginReplace()).
+  int replace_first;                     // First instruction being replaced (-1 if not editing).
+  int replace_count;                     // Number of instructions being replaced.
+  std::vector<cInst_Base *> replace_insts;                   // Parsed to take their place.
+  std::vector<std::pair<std::string,int> > replace_labels;   // Labels after them, to be moved.
+  bool ChargeOutput(int num_bytes);
+
+  // Infinite-loop detection: registers/scalars and memory are hashed incrementally as they are
+  // written; the rest of the state is folded in every loop_check_freq backward jumps.
+  int loop_check_freq;           // How many backward jumps between state checks? (0 = off)
+  int loop_jump_count;           // Backward jumps since the last check.
+  bool jumped_back;              // Did the current instruction jump backward?
+  unsigned long long state_hash; // Running hash of all non-zero registers, scalars, and memory.
+  int loop_check_count;          // Number of checks performed thus far.
+  int loop_next_save;            // Check count at which a fresh snapshot is taken.
+  cLoopSnapshot loop_snapshot;   // Most recent saved state to compare against.
+
+  // Checkpointing
+  std::string checkpoint_file;   // Where should periodic checkpoints be written?
+  int checkpoint_interval;       // How many cycles between checkpoints? (0 = off)
+  int next_checkpoint;           // Cycle count at which the next checkpoint is due.
+  std::string resume_file;       // Checkpoint to restore before the next Run().
+
+  // Undo journal for stepping backward; bounded to the most recent undo_limit steps.
+  int undo_limit;                   // Maximum number of steps that can be undone (0 = off).
+  std::deque<cUndoStep> undo_steps;
+  std::deque<cUndoEntry> undo_entries;
+  long long undo_base;              // Journal position of undo_entries.front().
+
+  void JournalStep();
+  void DropOldestUndoStep();
+  void Journal(int type, int id, int index, tValue value) {
+    if (undo_limit > 0) undo_entries.push_back(cUndoEntry(type, id, index, value));
+  }
+  void JournalArray(int type, int id, int index, const cArray & array) {
+    if (undo_limit > 0) undo_entries.push_back(cUndoEntry(type, id, index, array));
+  }
+  void UndoEntry(const cUndoEntry & entry);
+
+  // Change tracking for incremental display updates.
+  bool track_changes;
+  cChangeSet changes;
+  void NoteVarChange(int id) { if (track_changes) changes.Note(changes.vars, id); }
+  void NoteArrayChange(int id) { if (track_changes) changes.Note(changes.arrays, id); }
+  void NoteMemChange(int pos) { if (track_changes) changes.Note(changes.mem, pos); }
+
+  bool ClaimMemPages(int start, int count);
+  void RecordMemWrite(int pos, tValue value);
+
+  static unsigned long long HashMix(unsigned long long x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+  static unsigned long long ValueBits(tValue value) {
+    unsigned long long bits = 0;
+    memcpy(&bits, &value, sizeof(value));
+    return bits;
+  }
+  // Hash contribution of a single cell; zero-valued cells contribute nothing so unset == zero.
+  static unsigned long long HashCell(int type, int pos, tValue value) {
+    const unsigned long long bits = ValueBits(value);
+    if (bits == 0) return 0;
+    return HashMix((((unsigned long long) type) << 56) ^ (((unsigned long long) (unsigned int) pos) << 24) ^ bits);
+  }
+
+  unsigned long long CalcStateHash();
+  void SaveLoopSnapshot(unsigned long long hash);
+  bool MatchLoopSnapshot();
+  void CheckLoop();
 public:
-  cHardware() : mem_array(1<<16), max_mem_set(0), IP(0), advance_IP(false), exe_count(0)
-              , timeout(-1)
+  cHardware() : program(std::make_shared<cProgram>()), mem_array(1<<16), max_mem_set(0), IP(0), advance_IP(false), exe_count(0)
+              , timeout(-1), random(1), seed(1)
               , print_to_console(true), print_internal(true), count_cycles(false), verbose(false)
+              , halt_type(HALT_NONE), break_IP(-1), resume_IP(-1)
+              , wall_limit(-1.0), wall_countdown(0), wall_started(false)
+              , array_limit(-1), array_elements(0), stack_limit(-1), call_limit(100000)
+              , output_limit(-1), output_bytes(0)
+              , mem_page_limit(-1), mem_pages_used(0), mem_page_used(mem_array.size() >> MEM_PAGE_BITS, false)
+              , watch_targets(0), mem_page_watched(mem_page_used.size(), false), watch_stop(false)
+              , replace_first(-1), replace_count(0)
+              , loop_check_freq(0), loop_jump_count(0), jumped_back(false)
+              , state_hash(0), loop_check_count(0), loop_next_save(1)
+              , checkpoint_interval(0), next_checkpoint(0)
+              , undo_limit(0), undo_base(0), track_changes(false)
   {
-    // srand(time(NULL));
-    srand(1);
+    // random.Seed(time(NULL));
     // iout << "Console Output:" << std::endl;
   }
-  ~cHardware() { ; }
+  ~cHardware() {
+    for (int i = 0; i < (int) exe_stack.size(); i++) delete exe_stack[i];
+  }
 
-  const std::map<std::string,int> & GetLabelMap() { return label_map; }
+  const std::map<std::string,int> & GetLabelMap() { return program->label_map; }
 
-  int GetNumInsts() const { return (int) inst_vector.size(); }
-  cInst_Base * GetInst(int id) { return inst_vector[id]; }
+  int GetNumInsts() const { return (int) program->inst_vector.size(); }
+  cInst_Base * GetInst(int id) { return program->inst_vector[id]; }
   int GetExeCount() const { return exe_count; }
+  // Extra cost for bulk instructions; memory ones pay MEM_CYCLES_PER_POSITION for each position
+  // covered.  The cycle count is an int, so charges clamp rather than wrap around.
+  static const int MEM_CYCLES_PER_POSITION = 10;
+  static int AddCycles(int count, long long cycles) {
+    return (int) std::min<long long>((long long) count + cycles, INT_MAX);
+  }
+  void ChargeCycles(long long cycles) { exe_count = AddCycles(exe_count, cycles); }
+  void ChargeMemCycles(int positions) { ChargeCycles((long long) positions * MEM_CYCLES_PER_POSITION); }
 
+  // Parsed instructions, arguments, and label names are built in the program's arena.
+  cArena & GetArena() { EditProgram(); return *(program->arena); }
   void AddInst(cInst_Base * inst);
-  void AddLabel(std::string _l);
+  void SetInst(int inst_id, cInst_Base * inst);   // Replace an instruction already added.
+  void AddLabel(std::string _l, int pos=-1);   // At the next instruction added, by default.
+  void AddImport(const std::string & path) { EditProgram(); program->imports.push_back(path); }
+  void ReserveInsts(int num_insts) { EditProgram(); program->inst_vector.reserve(num_insts); }
+  const std::vector<std::string> & GetImports() const { return program->imports; }
+  bool HasReusedLabels() const { return program->labels_reused; }
+
+  // Edit a loaded program in place: instructions and labels added between BeginReplace() and
+  // EndReplace() take the place of instructions [first, first+count) and of the labels on
+  // positions first through first+count.  The lines parsed for them must end with the line of
+  // instruction first+count (if there is one), which is parsed again but kept as it was, and
+  // line_shift is the change in the number of source lines.  Execution continues where it was
+  // unless it is inside (or would return into) the replaced instructions, in which case the
+  // program is restarted and EndReplace() returns false.  The program must not be shared by a
+  // fork, since instructions outside the edit are updated.
+  void BeginReplace(int first, int count);
+  bool EndReplace(int line_shift);
 
   int FindLabel(std::string _l);
   int GetRandom(int rand_max) {
-    return rand() % rand_max;
+    Journal(UNDO_RANDOM, 0, random.GetStateWord(random.GetFront()), 0.0);
+    return random.Next() % rand_max;
   }
+  void SetSeed(unsigned int _seed) { seed = _seed; random.Seed(seed); }
+  unsigned int GetSeed() const { return seed; }
 
-  cVar GetVar(int id) { return var_map[id]; }
+  cVar GetVar(int id) {
+    // Reading must not create the variable, or reads would be changes that need undoing.
+    std::map<int,cVar>::const_iterator var_it = var_map.find(id);
+    return (var_it == var_map.end()) ? cVar() : var_it->second;
+  }
+  // GetVar() as read by an instruction, which watchpoints may need to report.
+  cVar ReadVar(int id) {
+    const cVar var = GetVar(id);
+    if (Watching(WATCH_VAR)) {
+      const tValue value = var.AsFloat();
+      NoteWatch(WATCH_VAR, id, 0, WATCH_READ, &value);
+    }
+    return var;
+  }
   const std::map<int,cVar> & GetVarMap() { return var_map; }
   // void SetVar(int id, int value) { var_map[id].Set(value); }
-  void SetVar(int id, float value) { var_map[id].Set(value); }
+  void SetVar(int id, tValue value) {
+    if (undo_limit > 0) {
+      std::map<int,cVar>::iterator var_it = var_map.find(id);
+      if (var_it == var_map.end()) Journal(UNDO_VAR, id, 0, 0.0);
+      else Journal(UNDO_VAR, id, 1, var_it->second.AsFloat());
+    }
+    cVar & var = var_map[id];
+    if (loop_check_freq > 0) state_hash ^= HashCell(0, id, var.AsFloat()) ^ HashCell(0, id, value);
+    var.Set(value);
+    NoteVarChange(id);
+    if (Watching(WATCH_VAR)) NoteWatch(WATCH_VAR, id, 0, WATCH_WRITE, &value);
+  }
 
   cArray & GetArray(int id) { return array_map[id]; }
+  // GetArray() for instructions that read the elements, which watchpoints may need to report.
+  const cArray & ReadArray(int id) {
+    if (Watching(WATCH_ARRAY)) NoteWatchArray(id, WATCH_READ, true);
+    return array_map[id];
+  }
+  tValue ReadArrayIndex(int id, int idx) {
+    const tValue value = array_map[id].GetIndex(idx);
+    if (Watching(WATCH_ARRAY)) NoteWatch(WATCH_ARRAY, id, idx, WATCH_READ, &value);
+    return value;
+  }
   const std::map<int,cArray> & GetArrayMap() { return array_map; }
-
-  void PushFloat(float value) { exe_stack.push_back(new cStackEntry(value)); }
-  void PushArray(const cArray & value) { exe_stack.push_back(new cStackEntry(value)); }
-  float PopFloat() {
+  bool ResizeArray(int id, int new_size);
+  bool SetArray(int id, const cArray & value);
+  void SetArrayIndex(int id, int idx, tValue value) {
+    cArray & array = array_map[id];
+    Journal(UNDO_ARRAY_IDX, id, idx, array.GetIndex(idx));
+    array.SetIndex(idx, value);
+    NoteArrayChange(id);
+    if (Watching(WATCH_ARRAY)) NoteWatch(WATCH_ARRAY, id, idx, WATCH_WRITE, &value);
+  }
+  cVar * EditArray(int id, int new_size);
+  long long GetArrayElements() const { return array_elements; }
+
+  bool CheckStackLimit() {
+    if (stack_limit < 0 || (int) exe_stack.size() < stack_limit) return true;
+    Halt(HALT_STACK_LIMIT);
+    (*this) << "Reached stack depth limit of " << stack_limit << ".  Halting." << '\n';
+    return false;
+  }
+  void PushFloat(tValue value) {
+    if (!CheckStackLimit()) return;
+    Journal(UNDO_PUSH, 0, 0, 0.0);
+    exe_stack.push_back(new cStackEntry(value));
+  }
+  void PushArray(const cArray & value) {
+    if (!CheckStackLimit()) return;
+    if (array_limit >= 0 && array_elements + value.GetSize() > array_limit) {
+      Halt(HALT_ARRAY_LIMIT);
+      (*this) << "Reached array element limit of " << array_limit << ".  Halting." << '\n';
+      return;
+    }
+    array_elements += value.GetSize();
+    Journal(UNDO_PUSH, 0, 0, 0.0);
+    exe_stack.push_back(new cStackEntry(value));
+  }
+  tValue PopFloat() {
     if (exe_stack.size() == 0) {
       Error("Attempting to pop off an empty stack.");
       return 0;
@@ -130,7 +588,8 @@ public:
       return 0;
     }
 
-    float out_val = exe_stack.back()->AsFloat();
+    tValue out_val = exe_stack.back()->AsFloat();
+    Journal(UNDO_POP, 0, 0, out_val);
     delete exe_stack.back();
     exe_stack.pop_back();
     return out_val;
@@ -146,6 +605,8 @@ public:
     }
 
     cArray out_val = exe_stack.back()->AsArray();
+    array_elements -= out_val.GetSize();
+    JournalArray(UNDO_POP, 0, 1, out_val);
     delete exe_stack.back();
     exe_stack.pop_back();
     return out_val;
@@ -155,93 +616,303 @@ public:
     if (line_num == -1) (*this) << "ERROR: " << msg << '\n';
     else (*this) << "ERROR(line " << line_num << "): " << msg << '\n';
   }
+
+  // Report an error the program can't go on from and stop it.  Only this machine stops, so that
+  // others running alongside it (under -q or -j) carry on.
+  void Abort(std::string msg) {
+    Error(msg);
+    Halt(HALT_ERROR);
+  }
   
-  float GetMemValue(int mem_pos) {
+  tValue GetMemValue(int mem_pos) {
     if (mem_pos < 0) {
-      Error("Cannot index into a negative memory position");
-      exit(1);
+      Abort("Cannot index into a negative memory position");
+      return 0;
     }
     if (mem_pos >= (int) mem_array.size()) {
       std::stringstream ss;
       ss << "Limit of " << mem_array.size() << " memory positions available.";
-      Error(ss.str());
-      exit(1);
+      Abort(ss.str());
+      return 0;
+    }
+    if (Watching(WATCH_MEM) && mem_page_watched[mem_pos >> MEM_PAGE_BITS]) {
+      const tValue value = mem_array[mem_pos];
+      NoteWatch(WATCH_MEM, 0, mem_pos, WATCH_READ, &value);
     }
     return mem_array[mem_pos];
   }
   
-  void SetMemValue(int mem_pos, float value) {
+  void SetMemValue(int mem_pos, tValue value) {
     if (mem_pos < 0) {
-      Error("Cannot index into a negative memory position");
-      exit(1);
+      Abort("Cannot index into a negative memory position");
+      return;
     }
     if (mem_pos >= (int) mem_array.size()) {
       std::stringstream ss;
       ss << "Limit of " << mem_array.size() << " memory positions available.";
-      Error(ss.str());
-      exit(1);
+      Abort(ss.str());
+      return;
+    }
+    const int page = mem_pos >> MEM_PAGE_BITS;
+    int new_page = -1;
+    if (mem_page_used[page] == false) {
+      if (mem_page_limit >= 0 && mem_pages_used >= mem_page_limit) {
+        Halt(HALT_MEM_LIMIT);
+        (*this) << "Reached memory page limit of " << mem_page_limit << ".  Halting." << '\n';
+        return;
+      }
+      mem_page_used[page] = true;
+      mem_pages_used++;
+      new_page = page;
     }
-    mem_array[mem_pos] = value;
+    Journal(UNDO_MEM, mem_pos, new_page, mem_array[mem_pos]);
+    if (loop_check_freq > 0) state_hash ^= HashCell(1, mem_pos, mem_array[mem_pos]) ^ HashCell(1, mem_pos, value);
+    mem_array.Set(mem_pos, value);
+    NoteMemChange(mem_pos);
     if (mem_pos > max_mem_set) max_mem_set = mem_pos;
+    if (Watching(WATCH_MEM) && mem_page_watched[page]) NoteWatch(WATCH_MEM, 0, mem_pos, WATCH_WRITE, &value);
   }
   
+  // Bulk memory operations; each range is bounds-checked once, rather than once per position.
+  bool CheckMemRange(int start, int count);   // False (and halted) if out of range.
+  void FillMem(int start, int count, tValue value);
+  void CopyMem(int from, int to, int count);
+  tValue SumMem(int start, int count) {
+    if (!CheckMemRange(start, count)) return 0;
+    if (Watching(WATCH_MEM)) NoteWatchMem(start, count, WATCH_READ);
+    return mem_array.Sum(start, count);
+  }
+  int CompareMem(int pos1, int pos2, int count) {
+    if (!CheckMemRange(pos1, count) || !CheckMemRange(pos2, count)) return 0;
+    if (Watching(WATCH_MEM)) {
+      NoteWatchMem(pos1, count, WATCH_READ);
+      NoteWatchMem(pos2, count, WATCH_READ);
+    }
+    return mem_array.Compare(pos1, pos2, count);
+  }
+
   int GetMaxMemSet() const { return max_mem_set; }
 
-  const std::vector<float> & GetMemArray() const { return mem_array; }
+  const cMemory & GetMemArray() const { return mem_array; }
 
 
   bool RunStep();
   bool Run();
+  void PrintCycles();   // The cycle count that ends a run with -c (not after an error or breakpoint stop).
+  int RunSteps(int num_steps);
 
   void Restart() {
     IP = 0;
     advance_IP = false;
     exe_count = 0;
 
-    for (int i = 0; i < (int) mem_array.size(); i++) mem_array[i] = 0;  // Is this needed?
+    mem_array.Clear();
+    max_mem_set = 0;
     var_map.clear();
     array_map.clear();
+    for (int i = 0; i < (int) exe_stack.size(); i++) delete exe_stack[i];
     exe_stack.clear();
+    call_stack.clear();
+    halt_type = HALT_NONE;
+    break_IP = resume_IP = -1;
+    next_checkpoint = checkpoint_interval;
+    watch_stop = false;
+    random.Seed(seed);
+
+    // Reset resource usage.
+    wall_countdown = 0;
+    wall_started = false;
+    array_elements = 0;
+    output_bytes = 0;
+    mem_pages_used = 0;
+    mem_page_used.assign(mem_page_used.size(), false);
+
+    // Nothing from before a restart can be undone.
+    undo_steps.clear();
+    undo_entries.clear();
+    undo_base = 0;
+
+    // Reset loop detection.
+    loop_jump_count = 0;
+    jumped_back = false;
+    state_hash = 0;
+    loop_check_count = 0;
+    loop_next_save = 1;
 
     // Clear the internal record of output.
     iout.clear();
     iout.str("");
+
+    changes.full = true;
   }
 
   int GetIP() { return IP; }
-  void JumpIP(int new_pos) { IP = new_pos; advance_IP = false; }
+  // Where execution will continue from: IP, unless stopped at a breakpoint.
+  int GetNextIP() const { return (halt_type == HALT_BREAK) ? break_IP : IP; }
+  void JumpIP(int new_pos) {
+    if (loop_check_freq > 0 && new_pos <= IP) jumped_back = true;
+    IP = new_pos;
+    advance_IP = false;
+  }
+
+  // Jump to target, remembering where to return to; too deep a chain of calls halts execution.
+  void Call(int target) {
+    if (call_limit >= 0 && (int) call_stack.size() >= call_limit) {
+      Halt(HALT_CALL_STACK);
+      (*this) << "Call stack overflow (limit of " << call_limit << " nested calls).  Halting." << '\n';
+      return;
+    }
+    call_stack.push_back(IP + 1);
+    Journal(UNDO_CALL, 0, 0, 0.0);
+    JumpIP(target);
+  }
+  void Return() {
+    if (call_stack.size() == 0) {
+      Error("ret: Return without a matching call.");
+      Halt(HALT_CALL_STACK);
+      return;
+    }
+    const int target = call_stack.back();
+    call_stack.pop_back();
+    Journal(UNDO_RETURN, target, 0, 0.0);
+    JumpIP(target);
+  }
+  int GetCallDepth() const { return (int) call_stack.size(); }
+
+  // Stop execution, recording the reason why.
+  void Halt(int _type) {
+    halt_type = _type;
+    IP = (int) program->inst_vector.size(); // Move IP to end to stop further execution.
+    advance_IP = false;
+  }
+  int GetHaltType() const { return halt_type; }
+  int GetExitCode() const { return ExitCodeFor(halt_type); }
+  bool AtBreakpoint() const { return halt_type == HALT_BREAK; }
+  static int ExitCodeFor(int _type) {
+    if (_type == HALT_ERROR) return 1;   // As when errors ended the process.
+    return (_type >= HALT_LOOP) ? _type : 0;
+  }
 
   void SetTimeout(int _to) { timeout = _to; }
+  int GetTimeout() const { return timeout; }
+  int GetCallLimit() const { return call_limit; }
+  void SetPrintToConsole(bool _print) { print_to_console = _print; }
+  void SetWallTimeLimit(double _secs) { wall_limit = _secs; }
+  void SetArrayLimit(int _max) { array_limit = _max; }
+  void SetStackLimit(int _max) { stack_limit = _max; }
+  void SetCallLimit(int _max) { call_limit = _max; }
+  void SetOutputLimit(long long _max) { output_limit = _max; }
+  void SetMemPageLimit(int _max) { mem_page_limit = _max; }
+  void SetLoopCheck(int _freq);
+  double GetWallTimeLimit() const { return wall_limit; }
+  long long GetOutputLimit() const { return output_limit; }
+  int GetMemPageLimit() const { return mem_page_limit; }
+  int GetLoopCheck() const { return loop_check_freq; }
+
+  // Build a new hardware continuing from this one's current state.  The program, memory pages,
+  // and arrays are shared copy-on-write, so their cost is proportional to the state touched later;
+  // the output so far is copied in full.  Instructions are re-pointed at whichever hardware runs
+  // them, so forks still sharing a program must not run on different threads at the same time
+  // (loading or editing a program gives the fork its own copy).
+  cHardware * Fork();
+
+  // Snapshots of the full machine state (native byte order); the program itself is not saved,
+  // only a fingerprint to make sure a snapshot is restored into the same program.
+  unsigned long long GetProgramHash();
+  bool SaveState(std::ostream & out);
+  bool LoadState(std::istream & in);
+  bool SaveStateFile(const std::string & filename);
+  bool LoadStateFile(const std::string & filename);
+  void SetCheckpoint(const std::string & filename, int interval) {
+    checkpoint_file = filename;
+    checkpoint_interval = interval;
+    next_checkpoint = exe_count + interval;
+  }
+  void SetResumeFile(const std::string & filename) { resume_file = filename; }
+  bool HasCheckpoint() const { return checkpoint_interval > 0; }
+  bool HasResumeFile() const { return resume_file.size() > 0; }
+
+  // Fingerprint of everything that decides how Run() will go from here: program, current state,
+  // seed and limits.  Runs that write files or resume from one are not repeatable by it alone.
+  unsigned long long GetRunHash();
+  bool IsRepeatable() const {
+    return !verbose && checkpoint_interval == 0 && resume_file.size() == 0 && watchpoints.size() == 0;
+  }
+
+  // Breakpoints, optionally stopping only when condition holds.  Setting one swaps the
+  // instruction for a trap, so nothing else is checked while running.
+  bool SetBreakpoint(int inst_id, const tBreakCondition & condition=tBreakCondition());
+  bool ClearBreakpoint(int inst_id);
+  void ClearAllBreakpoints();
+  bool HasBreakpoint(int inst_id) const;
+  bool StopAtBreakpoint(const tBreakCondition & condition);
+
+  // Watch what (such as "mem[100]", "mem[100-199]", "regA", "s3", or "a2[5]") for the given
+  // accesses (see WatchAccess), reporting each one and, if stop is set, stopping as at a
+  // breakpoint once the instruction making it is done.  Returns false if what isn't understood.
+  bool AddWatchpoint(const std::string & what, int access, bool stop);
+  void ClearWatchpoints();
+  const std::vector<cWatchpoint> & GetWatchpoints() const { return watchpoints; }
+
+  // Reverse execution.  Each step back costs time proportional to the changes it made.
+  void SetUndoLimit(int _steps);
+  int GetUndoDepth() const { return (int) undo_steps.size(); }
+  bool StepBack();
+  bool RunBackTo(int target_IP);
+
+  // Change tracking: GetChanges() lists what changed since the last ClearChanges().
+  void TrackChanges(bool _track) { track_changes = _track; ClearChanges(); }
+  const cChangeSet & GetChanges() const { return changes; }
+  void ClearChanges() {
+    changes.old_IP = GetNextIP();
+    changes.vars.clear();
+    changes.arrays.clear();
+    changes.mem.clear();
+    changes.output_start = print_internal ? (long long) iout.tellp() : 0;
+    changes.full = false;
+  }
   void CountCPUCycles() { count_cycles = true; }
+  bool IsCountingCycles() const { return count_cycles; }
 
   // A simple method to print strings in the correct place.
   void PrintString(const std::string & msg) {
+    if (!ChargeOutput((int) msg.size())) return;
     if (print_to_console) std::cout << msg;
     if (print_internal) iout << msg;
   }
+  void PrintChars(const char * msg, int size) {
+    if (!ChargeOutput(size)) return;
+    if (print_to_console) std::cout.write(msg, size);
+    if (print_internal) iout.write(msg, size);
+  }
 
   // Operator overloading to simply print strings in the correct place.
   cHardware & operator<<(const std::string & msg) {
-    if (print_to_console) std::cout << msg;
-    if (print_internal) iout << msg;
+    PrintString(msg);
     return *this;
   }
 
   cHardware & operator<<(char msg) {
+    if (!ChargeOutput(1)) return *this;
     if (print_to_console) std::cout << msg;
     if (print_internal) iout << msg;
     return *this;
   }
 
-  cHardware & operator<<(int msg) {
-    if (print_to_console) std::cout << msg;
-    if (print_internal) iout << msg;
+  // Numbers are formatted once, into a local buffer, so that their length can be charged against
+  // the output limit; the text matches what std::ostream would print.
+  cHardware & operator<<(int msg) { return (*this) << (long long) msg; }
+  cHardware & operator<<(float msg) { return (*this) << (double) msg; }
+
+  cHardware & operator<<(double msg) {
+    char buffer[FORMAT_BUFFER_SIZE];
+    PrintChars(buffer, FormatFloat(msg, buffer));
     return *this;
   }
 
-  cHardware & operator<<(float msg) {
-    if (print_to_console) std::cout << msg;
-    if (print_internal) iout << msg;
+  cHardware & operator<<(long long msg) {
+    char buffer[FORMAT_BUFFER_SIZE];
+    PrintChars(buffer, FormatInt(msg, buffer));
     return *this;
   }
 
@@ -250,27 +921,33 @@ public:
   }
 
 
+  bool IsVerbose() const { return verbose; }
   void SetVerbose() {
     if (verbose) return;
     verbose = true;
     v_file.open("trace.dat");
   }
-  void PrintVerbose(const std::string & out_string, cInstArg_Base * arg1=NULL, cInstArg_Base * arg2=NULL, cInstArg_Base * arg3=NULL) {
+  void PrintVerbose(const std::string & out_string, cInstArg_Base * arg1=NULL, cInstArg_Base * arg2=NULL, cInstArg_Base * arg3=NULL,
+                    cInstArg_Base * arg4=NULL) {
     if (verbose==true) {
       v_file << ":: " << IP << " :: " << out_string;
-      float cur_float = -1;
+      tValue cur_float = -1;
       if (arg1) {
-        cur_float = arg1->AsFloat();
+        cur_float = arg1->PeekFloat();   // Tracing mustn't trigger watchpoints.
         v_file << " " << arg1->VerboseString() << "(" << cur_float << ")";
       }
       if (arg2) {
-        cur_float = arg2->AsFloat();
+        cur_float = arg2->PeekFloat();
         v_file << " " << arg2->VerboseString() << "(" << cur_float << ")";
       }
       if (arg3) {
-        cur_float = arg3->AsFloat();
+        cur_float = arg3->PeekFloat();
         v_file << " " << arg3->VerboseString() << "(" << cur_float << ")";
       }
+      if (arg4) {
+        cur_float = arg4->PeekFloat();
+        v_file << " " << arg4->VerboseString() << "(" << cur_float << ")";
+      }
       v_file << std::endl;
     }
   }
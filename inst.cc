@@ -1,10 +1,12 @@
 #include "inst.h"
 
+#include <algorithm>
+#include <cmath>
 #include <string>
 #include <sstream>
 #include "hardware.h"
 
-int cInstArg_Label::AsInt()
+tInt cInstArg_Label::AsInt()
 {
   if (value == -1) {
     value = hardware->FindLabel(label);
@@ -13,35 +15,45 @@ int cInstArg_Label::AsInt()
 }
 
 
-bool cInstArg_Var::SetFloat(float value)
+bool cInstArg_Var::SetFloat(tValue value)
 {
   hardware->SetVar(var_id, value);
   return true;
 }
 
-int cInstArg_Var::AsInt()
+tInt cInstArg_Var::AsInt()
 {
-  return hardware->GetVar(var_id).AsInt();
+  return hardware->ReadVar(var_id).AsInt();
 }
 
-float cInstArg_Var::AsFloat()
+tValue cInstArg_Var::AsFloat()
+{
+  return hardware->ReadVar(var_id).AsFloat();
+}
+
+tValue cInstArg_Var::PeekFloat()
 {
   return hardware->GetVar(var_id).AsFloat();
 }
 
 
-bool cInstArg_Reg::SetFloat(float value)
+bool cInstArg_Reg::SetFloat(tValue value)
 {
   hardware->SetVar(reg_id, value);
   return true;
 }
 
-int cInstArg_Reg::AsInt()
+tInt cInstArg_Reg::AsInt()
 {
-  return hardware->GetVar(reg_id).AsInt();
+  return hardware->ReadVar(reg_id).AsInt();
 }
 
-float cInstArg_Reg::AsFloat()
+tValue cInstArg_Reg::AsFloat()
+{
+  return hardware->ReadVar(reg_id).AsFloat();
+}
+
+tValue cInstArg_Reg::PeekFloat()
 {
   return hardware->GetVar(reg_id).AsFloat();
 }
@@ -53,14 +65,14 @@ bool cInstArg_IP::SetInt(int value)
   return true;
 }
 
-int cInstArg_IP::AsInt()
+tInt cInstArg_IP::AsInt()
 {
   return hardware->GetIP();
 }
 
-float cInstArg_IP::AsFloat()
+tValue cInstArg_IP::AsFloat()
 {
-  return (float) hardware->GetIP();
+  return (tValue) hardware->GetIP();
 }
 
 
@@ -75,7 +87,7 @@ void cInst_Base::PrintString(const std::string & msg)
 
 void cInst_Base::PrintVerbose(const std::string & out_string)
 {
-  hardware->PrintVerbose(out_string, arg1, arg2, arg3);
+  hardware->PrintVerbose(out_string, arg1, arg2, arg3, arg4);
 }
 
 bool cInst_DIV::Run()
@@ -87,7 +99,7 @@ bool cInst_DIV::Run()
     return false;
   }
 
-  arg3->SetFloat(arg1->AsFloat() / arg2->AsFloat());
+  arg3->SetFloat(DivValues(arg1->AsFloat(), arg2->AsFloat()));
     
   return true;
 }
@@ -100,7 +112,7 @@ bool cInst_MOD::Run()
     hardware->Error("mod: Division by Zero");
     return false;
   }
-  arg3->SetFloat((float) (arg1->AsInt() % arg2->AsInt()));
+  arg3->SetFloat((tValue) ModInts(arg1->AsInt(), arg2->AsInt()));
 
   return true;
 }
@@ -129,6 +141,22 @@ bool cInst_JUMP_IF_N0::Run()
   return true;
 }
 
+bool cInst_CALL::Run()
+{
+  PrintVerbose("call");
+
+  hardware->Call(arg1->AsInt());
+  return true;
+}
+
+bool cInst_RET::Run()
+{
+  PrintVerbose("ret");
+
+  hardware->Return();
+  return true;
+}
+
 bool cInst_RANDOM::Run()
 {
   PrintVerbose("random");
@@ -138,7 +166,7 @@ bool cInst_RANDOM::Run()
     hardware->Error("random: must have a positive upper limit");
     return false;
   }
-  arg2->SetFloat((float) hardware->GetRandom(rand_max));
+  arg2->SetFloat((tValue) hardware->GetRandom(rand_max));
   return true;
 }
 
@@ -181,7 +209,7 @@ bool cInst_PUSH_ARRAY::Run()
 {
   PrintVerbose("push (array)");
 
-  cArray & array = hardware->GetArray(arg1->AsInt());
+  const cArray & array = hardware->ReadArray(arg1->AsInt());
   hardware->PushArray(array);
   return true;
 }
@@ -198,8 +226,7 @@ bool cInst_POP_ARRAY::Run()
 {
   PrintVerbose("pop (array)");
 
-  cArray & array = hardware->GetArray(arg1->AsInt());
-  array = hardware->PopArray();
+  hardware->SetArray(arg1->AsInt(), hardware->PopArray());
   return true;
 }
 
@@ -217,7 +244,7 @@ bool cInst_AR_GET_IDX::Run()
     return false;
   }
 
-  float out_val = array.GetIndex(index);
+  tValue out_val = hardware->ReadArrayIndex(arg1->AsInt(), index);
   arg3->SetFloat(out_val);
 
   return true;
@@ -237,8 +264,8 @@ bool cInst_AR_SET_IDX::Run()
     return false;
   }
 
-  float new_val = arg3->AsFloat();
-  array.SetIndex(index, new_val);
+  tValue new_val = arg3->AsFloat();
+  hardware->SetArrayIndex(arg1->AsInt(), index, new_val);
 
   return true;
 }
@@ -257,34 +284,258 @@ bool cInst_AR_SET_SIZ::Run()
 {
   PrintVerbose("ar_set_siz");
 
-  cArray & array = hardware->GetArray(arg1->AsInt());
   int new_size = arg2->AsInt();
   if (new_size < 0) {
     hardware->Error("ar_set_siz: Cannot set array size to a negative value");
     return false;
   }
-  array.Resize(new_size);
 
-  return true;
+  return hardware->ResizeArray(arg1->AsInt(), new_size);
 }
 
 bool cInst_AR_COPY::Run() 
 {
   PrintVerbose("ar_copy");
 
-  cArray & array1 = hardware->GetArray(arg1->AsInt());
-  cArray & array2 = hardware->GetArray(arg2->AsInt());
+  const cArray & array1 = hardware->ReadArray(arg1->AsInt());
+
+  return hardware->SetArray(arg2->AsInt(), array1);
+}
+
+
+////////////////
+// Bulk array instructions
+////////////////
+
+// The loops below are kept simple so the compiler can vectorize them; bulk instructions are charged
+// one extra cycle for every BULK_ELEMENTS_PER_CYCLE elements they process.
+static const int BULK_ELEMENTS_PER_CYCLE = 4;
+
+// Reductions keep this many independent partial results (combined in a fixed order at the end) so
+// that they vectorize without letting the compiler reorder the arithmetic; results are the same on
+// every build.
+static const int REDUCE_LANES = 8;
+
+static void ChargeBulk(cHardware * hardware, long long elements)
+{
+  hardware->ChargeCycles(elements / BULK_ELEMENTS_PER_CYCLE);
+}
+
+// Shared by ar_add, ar_sub, and ar_mult: arg2 may be an array of the same size, or a single value.
+template <typename OP>
+static bool ArrayMath(cHardware * hardware, const char * name, int line_num,
+                      cInstArg_Base * arg1, cInstArg_Base * arg2, cInstArg_Base * arg3, OP op)
+{
+  const int size = hardware->GetArray(arg1->AsInt()).GetSize();
+  const bool use_array = arg2->IsArray();
+  if (use_array && hardware->GetArray(arg2->AsInt()).GetSize() != size) {
+    std::stringstream err;
+    err << name << ": Array sizes do not match (" << size << " vs. "
+        << hardware->GetArray(arg2->AsInt()).GetSize() << ").";
+    hardware->Error(err.str(), line_num);
+    return false;
+  }
+  const tValue value = use_array ? 0.0 : arg2->AsFloat();
+
+  // Prepare the output first, since it may be (or share data with) one of the inputs.
+  cVar * out = hardware->EditArray(arg3->AsInt(), size);
+  if (out == NULL) return false;
+  const cVar * in1 = hardware->ReadArray(arg1->AsInt()).GetData();
+
+  if (use_array) {
+    const cVar * in2 = hardware->ReadArray(arg2->AsInt()).GetData();
+    for (int i = 0; i < size; i++) out[i].Set(op(in1[i].AsFloat(), in2[i].AsFloat()));
+  } else {
+    for (int i = 0; i < size; i++) out[i].Set(op(in1[i].AsFloat(), value));
+  }
+
+  ChargeBulk(hardware, size);
+  return true;
+}
+
+// Combine all elements of data with op, starting each partial result from init.
+template <typename OP>
+static tValue ArrayReduce(const cVar * data, int size, tValue init, OP op)
+{
+  tValue lanes[REDUCE_LANES];
+  for (int j = 0; j < REDUCE_LANES; j++) lanes[j] = init;
+
+  int i = 0;
+  for (; i + REDUCE_LANES <= size; i += REDUCE_LANES) {
+    for (int j = 0; j < REDUCE_LANES; j++) lanes[j] = op(lanes[j], data[i+j].AsFloat());
+  }
+
+  tValue result = lanes[0];
+  for (int j = 1; j < REDUCE_LANES; j++) result = op(result, lanes[j]);
+  for (; i < size; i++) result = op(result, data[i].AsFloat());
+  return result;
+}
+
+bool cInst_AR_ADD::Run()
+{
+  PrintVerbose("ar_add");
+  return ArrayMath(hardware, "ar_add", line_num, arg1, arg2, arg3,
+                   [](tValue a, tValue b) { return a + b; });
+}
+
+bool cInst_AR_SUB::Run()
+{
+  PrintVerbose("ar_sub");
+  return ArrayMath(hardware, "ar_sub", line_num, arg1, arg2, arg3,
+                   [](tValue a, tValue b) { return a - b; });
+}
+
+bool cInst_AR_MULT::Run()
+{
+  PrintVerbose("ar_mult");
+  return ArrayMath(hardware, "ar_mult", line_num, arg1, arg2, arg3,
+                   [](tValue a, tValue b) { return a * b; });
+}
+
+bool cInst_AR_FILL::Run()
+{
+  PrintVerbose("ar_fill");
+
+  const tValue value = arg2->AsFloat();
+  const int size = hardware->GetArray(arg1->AsInt()).GetSize();
+  cVar * out = hardware->EditArray(arg1->AsInt(), size);
+  if (out == NULL) return false;
+  for (int i = 0; i < size; i++) out[i].Set(value);
+
+  ChargeBulk(hardware, size);
+  return true;
+}
+
+bool cInst_AR_SUM::Run()
+{
+  PrintVerbose("ar_sum");
+
+  const cArray & array = hardware->ReadArray(arg1->AsInt());
+  const tValue total = ArrayReduce(array.GetData(), array.GetSize(), 0.0,
+                                  [](tValue a, tValue b) { return a + b; });
+  ChargeBulk(hardware, array.GetSize());
+  arg2->SetFloat(total);
+
+  return true;
+}
 
-  array2 = array1;
+bool cInst_AR_MIN::Run()
+{
+  PrintVerbose("ar_min");
+
+  const cArray & array = hardware->ReadArray(arg1->AsInt());
+  if (array.GetSize() == 0) {
+    hardware->Error("ar_min: Cannot find the smallest element of an empty array", line_num);
+    return false;
+  }
+  const tValue result = ArrayReduce(array.GetData(), array.GetSize(), array.GetIndex(0),
+                                   [](tValue a, tValue b) { return (b < a) ? b : a; });
+  ChargeBulk(hardware, array.GetSize());
+  arg2->SetFloat(result);
 
   return true;
 }
 
+bool cInst_AR_MAX::Run()
+{
+  PrintVerbose("ar_max");
+
+  const cArray & array = hardware->ReadArray(arg1->AsInt());
+  if (array.GetSize() == 0) {
+    hardware->Error("ar_max: Cannot find the largest element of an empty array", line_num);
+    return false;
+  }
+  const tValue result = ArrayReduce(array.GetData(), array.GetSize(), array.GetIndex(0),
+                                   [](tValue a, tValue b) { return (b > a) ? b : a; });
+  ChargeBulk(hardware, array.GetSize());
+  arg2->SetFloat(result);
+
+  return true;
+}
+
+bool cInst_AR_DOT::Run()
+{
+  PrintVerbose("ar_dot");
+
+  const cArray & array1 = hardware->ReadArray(arg1->AsInt());
+  const cArray & array2 = hardware->ReadArray(arg2->AsInt());
+  const int size = array1.GetSize();
+  if (array2.GetSize() != size) {
+    std::stringstream err;
+    err << "ar_dot: Array sizes do not match (" << size << " vs. " << array2.GetSize() << ").";
+    hardware->Error(err.str(), line_num);
+    return false;
+  }
+
+  const cVar * in1 = array1.GetData();
+  const cVar * in2 = array2.GetData();
+  tValue lanes[REDUCE_LANES] = { 0 };
+  int i = 0;
+  for (; i + REDUCE_LANES <= size; i += REDUCE_LANES) {
+    for (int j = 0; j < REDUCE_LANES; j++) lanes[j] += in1[i+j].AsFloat() * in2[i+j].AsFloat();
+  }
+  tValue total = lanes[0];
+  for (int j = 1; j < REDUCE_LANES; j++) total += lanes[j];
+  for (; i < size; i++) total += in1[i].AsFloat() * in2[i].AsFloat();
+
+  ChargeBulk(hardware, size);
+  arg3->SetFloat(total);
+
+  return true;
+}
+
+bool cInst_AR_COPY_RANGE::Run()
+{
+  PrintVerbose("ar_copy_range");
+
+  const int start = arg2->AsInt();
+  const int src_size = hardware->GetArray(arg1->AsInt()).GetSize();
+  const int count = hardware->GetArray(arg3->AsInt()).GetSize();
+  if (start < 0 || start + count > src_size) {
+    std::stringstream err;
+    err << "ar_copy_range: Range out of bounds (start=" << start << " count=" << count
+        << " array_size=" << src_size << ").";
+    hardware->Error(err.str(), line_num);
+    return false;
+  }
+
+  // Copying forward is safe even if source and destination are the same array, since start >= 0.
+  cVar * out = hardware->EditArray(arg3->AsInt(), count);
+  if (out == NULL) return false;
+  const cVar * in = hardware->ReadArray(arg1->AsInt()).GetData();
+  std::copy(in + start, in + start + count, out);
+
+  ChargeBulk(hardware, count);
+  return true;
+}
+
+bool cInst_AR_SORT::Run()
+{
+  PrintVerbose("ar_sort");
+
+  const int size = hardware->GetArray(arg1->AsInt()).GetSize();
+  cVar * data = hardware->EditArray(arg1->AsInt(), size);
+  if (data == NULL) return false;
+  // NaNs go last, so that the order stays strict even when values don't compare.
+  std::sort(data, data + size, [](const cVar & a, const cVar & b) {
+      const tValue a_value = a.AsFloat();
+      const tValue b_value = b.AsFloat();
+      if (std::isnan(a_value)) return false;
+      return std::isnan(b_value) || a_value < b_value;
+    });
+
+  // Charge for roughly size * log2(size) comparisons.
+  int log_size = 1;
+  while ((1LL << log_size) < size) log_size++;
+  ChargeBulk(hardware, (long long) size * log_size);
+  return true;
+}
+
 bool cInst_LOAD::Run() 
 {
   PrintVerbose("load");
 
-  float mem_value = hardware->GetMemValue(arg1->AsInt());
+  tValue mem_value = hardware->GetMemValue(arg1->AsInt());
   arg2->SetFloat(mem_value);
 
 
@@ -304,12 +555,64 @@ bool cInst_MEM_COPY::Run()
 {
   PrintVerbose("mem_copy");
 
-  float mem_value = hardware->GetMemValue(arg1->AsInt());
+  tValue mem_value = hardware->GetMemValue(arg1->AsInt());
   hardware->SetMemValue(arg2->AsInt(), mem_value);
 
   return true;
 }
 
+// Bulk memory instructions pay the base cost of a memory access once, plus a smaller cost for each
+// position they cover (only if the range was valid).
+bool cInst_MEM_FILL::Run()
+{
+  PrintVerbose("mem_fill");
+
+  const int start = arg2->AsInt(), count = arg3->AsInt();
+  if (!hardware->CheckMemRange(start, count)) return true;
+  hardware->FillMem(start, count, arg1->AsFloat());
+  hardware->ChargeMemCycles(count);
+
+  return true;
+}
+
+bool cInst_MEM_BLOCK_COPY::Run()
+{
+  PrintVerbose("mem_block_copy");
+
+  const int from = arg1->AsInt(), to = arg2->AsInt(), count = arg3->AsInt();
+  if (!hardware->CheckMemRange(from, count) || !hardware->CheckMemRange(to, count)) return true;
+  hardware->CopyMem(from, to, count);
+  hardware->ChargeMemCycles(count);
+
+  return true;
+}
+
+bool cInst_MEM_COMPARE::Run()
+{
+  PrintVerbose("mem_compare");
+
+  const int pos1 = arg1->AsInt(), pos2 = arg2->AsInt(), count = arg3->AsInt();
+  if (!hardware->CheckMemRange(pos1, count) || !hardware->CheckMemRange(pos2, count)) return true;
+  const int result = hardware->CompareMem(pos1, pos2, count);
+  hardware->ChargeMemCycles(count);
+  arg4->SetFloat(result);
+
+  return true;
+}
+
+bool cInst_MEM_SUM::Run()
+{
+  PrintVerbose("mem_sum");
+
+  const int start = arg1->AsInt(), count = arg2->AsInt();
+  if (!hardware->CheckMemRange(start, count)) return true;
+  const tValue total = hardware->SumMem(start, count);
+  hardware->ChargeMemCycles(count);
+  arg3->SetFloat(total);
+
+  return true;
+}
+
 bool cInst_DEBUG_STATUS::Run() 
 {
   PrintVerbose("debug_status");
@@ -319,3 +622,19 @@ bool cInst_DEBUG_STATUS::Run()
   return true;
 }
 
+bool cInst_END::Run()
+{
+  PrintVerbose("end");
+
+  hardware->Halt(HALT_END);
+  return true;
+}
+
+
+bool cInst_BREAK::Run()
+{
+  if (hardware->StopAtBreakpoint(condition)) return true;
+
+  if (inst->GetHardware() != hardware) inst->SetHardware(hardware);
+  return inst->Run();
+}
@@ -2,11 +2,45 @@
 #define INST_H
 
 #include <assert.h>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <sstream>
 #include <vector>
 
+#include "arena.h"
+
+// Type of every value in registers, scalars, memory, arrays, and the stack.  Floats by default;
+// build with TUBE_VALUE_DOUBLE for doubles, or TUBE_VALUE_INT for 64-bit integers (exact above
+// 2^24, with no conversions for indices, jumps, and mod).  Methods named "Float" use this type;
+// tInt is the type values take as whole numbers (by "Int" methods, out_int, and mod), which is
+// 64 bits wide in the integer build so that nothing is truncated.
+#if defined(TUBE_VALUE_DOUBLE)
+typedef double tValue;
+typedef int tInt;
+#define TUBE_VALUE_NAME "double"
+#elif defined(TUBE_VALUE_INT)
+typedef long long tValue;
+typedef long long tInt;
+#define TUBE_VALUE_NAME "int"
+#else
+typedef float tValue;
+typedef int tInt;
+#define TUBE_VALUE_NAME "float"
+#endif
+
+// Division and remainder that never trap on a nonzero divisor: the most negative whole number
+// divided by -1 wraps back to itself, and any remainder by -1 is 0.
+inline tValue DivValues(tValue a, tValue b)
+{
+#if defined(TUBE_VALUE_INT)
+  if (b == -1) return (tValue) (0ULL - (unsigned long long) a);
+#endif
+  return a / b;
+}
+
+inline tInt ModInts(tInt a, tInt b) { return (b == -1) ? 0 : a % b; }
+
 class cHardware;
 
 class cInstArg_Base {
@@ -17,30 +51,35 @@ public:
   virtual ~cInstArg_Base() { ; }
 
   virtual bool IsVar() { return false; }
-  virtual bool SetFloat(float value) = 0 ;//{ assert(false); (void) value; return false; }
+  virtual bool IsArray() { return false; }
+  virtual bool SetFloat(tValue value) = 0 ;//{ assert(false); (void) value; return false; }
 
-  virtual int AsInt() = 0;
-  virtual float AsFloat() = 0;
+  virtual tInt AsInt() = 0;
+  virtual tValue AsFloat() = 0;
+  virtual tValue PeekFloat() { return AsFloat(); }   // As AsFloat(), but not counted as a read.
   virtual std::string VerboseString() = 0;
+  virtual void Relink() { ; }   // Forget anything looked up in the program, after it is edited.
+  virtual cInstArg_Base * Clone(cArena & arena) const = 0;   // Copy of this argument, built in arena.
 
   void SetHardware(cHardware * _h) { hardware = _h; }
 };
 
 class cInstArg_Float : public cInstArg_Base {
 private:
-  float value;
+  tValue value;
 public:
-  cInstArg_Float(float _v) : value(_v) { ; }
+  cInstArg_Float(tValue _v) : value(_v) { ; }
   ~cInstArg_Float() { ; }
+  cInstArg_Base * Clone(cArena & arena) const { return arena.New<cInstArg_Float>(*this); }
 
-  bool SetFloat(float value) {
+  bool SetFloat(tValue value) {
     assert(false && "Calling set on cInstArg_Float");
     (void) value;
     return false;
   }
 
-  int AsInt() { return value; }
-  float AsFloat() { return value; }
+  tInt AsInt() { return value; }
+  tValue AsFloat() { return value; }
   std::string VerboseString() {
     std::stringstream ss;
     ss << value;
@@ -55,15 +94,19 @@ private:
 public:
   cInstArg_Label(std::string _l) : label(_l), value(-1) { ; }
   ~cInstArg_Label() { ; }
+  cInstArg_Base * Clone(cArena & arena) const { return arena.New<cInstArg_Label>(*this); }
 
-  bool SetFloat(float value) {
+  const std::string & GetLabel() const { return label; }
+  void Relink() { value = -1; }
+
+  bool SetFloat(tValue value) {
     assert(false && "Calling set on cInstArg_Label");
     (void) value;
     return false;
   }
 
-  int AsInt();
-  float AsFloat() { return (float) AsInt(); }
+  tInt AsInt();
+  tValue AsFloat() { return (tValue) AsInt(); }
   std::string VerboseString() {
     std::stringstream ss;
     ss << label;
@@ -77,17 +120,21 @@ private:
 public:
   cInstArg_Var(int _id) : var_id(_id) { ; }
   ~cInstArg_Var() { ; }
+  cInstArg_Base * Clone(cArena & arena) const { return arena.New<cInstArg_Var>(*this); }
+
+  int GetID() const { return var_id; }
 
   bool IsVar() { return true; }
-  bool SetFloat(float value);
+  bool SetFloat(tValue value);
   std::string VerboseString() {
     std::stringstream ss;
     ss << "s" << var_id;
     return ss.str();
   }
  
-  int AsInt();
-  float AsFloat();
+  tInt AsInt();
+  tValue AsFloat();
+  tValue PeekFloat();
 };
 
 class cInstArg_Array : public cInstArg_Base {
@@ -96,15 +143,17 @@ private:
 public:
   cInstArg_Array(int _id) : var_id(_id) { ; }
   ~cInstArg_Array() { ; }
+  cInstArg_Base * Clone(cArena & arena) const { return arena.New<cInstArg_Array>(*this); }
 
-  bool SetFloat(float value) {
+  bool IsArray() { return true; }
+  bool SetFloat(tValue value) {
     assert(false && "Calling set on cInstArg_Array");
     (void) value;
     return false;
   }
 
-  int AsInt() { return var_id; };
-  float AsFloat() { return 0.0; };
+  tInt AsInt() { return var_id; };
+  tValue AsFloat() { return 0.0; };
   std::string VerboseString() {
     std::stringstream ss;
     ss << "a" << var_id;
@@ -118,17 +167,21 @@ private:
 public:
   cInstArg_Reg(int _id) : reg_id(_id) { ; }
   ~cInstArg_Reg() { ; }
+  cInstArg_Base * Clone(cArena & arena) const { return arena.New<cInstArg_Reg>(*this); }
+
+  int GetID() const { return reg_id; }
 
   bool IsVar() { return false; }
-  bool SetFloat(float value);
+  bool SetFloat(tValue value);
   std::string VerboseString() {
     std::stringstream ss;
     ss << "reg" << (char) ('A' + reg_id);
     return ss.str();
   }
  
-  int AsInt();
-  float AsFloat();
+  tInt AsInt();
+  tValue AsFloat();
+  tValue PeekFloat();
 };
 
 class cInstArg_IP : public cInstArg_Base {
@@ -136,8 +189,9 @@ private:
 public:
   cInstArg_IP() { ; }
   ~cInstArg_IP() { ; }
+  cInstArg_Base * Clone(cArena & arena) const { return arena.New<cInstArg_IP>(*this); }
 
-  bool SetFloat(float value) {
+  bool SetFloat(tValue value) {
     assert(false && "Calling set on cInstArg_IP");
     (void) value;
     return false;
@@ -149,8 +203,8 @@ public:
     return "IP";
   }
  
-  int AsInt();
-  float AsFloat();
+  tInt AsInt();
+  tValue AsFloat();
 };
 
 
@@ -165,25 +219,31 @@ protected:
   cInstArg_Base * arg1;
   cInstArg_Base * arg2;
   cInstArg_Base * arg3;
+  cInstArg_Base * arg4;  // Only used by a few instructions that need an extra operand.
 public:
-  cInst_Base(int ln, cInstArg_Base * _a1=NULL, cInstArg_Base * _a2=NULL, cInstArg_Base * _a3=NULL)
-    : line_num(ln), arg1(_a1), arg2(_a2), arg3(_a3) { ; }
-  ~cInst_Base() { ; }
+  cInst_Base(int ln, cInstArg_Base * _a1=NULL, cInstArg_Base * _a2=NULL, cInstArg_Base * _a3=NULL,
+             cInstArg_Base * _a4=NULL)
+    : hardware(NULL), line_num(ln), arg1(_a1), arg2(_a2), arg3(_a3), arg4(_a4) { ; }
+  virtual ~cInst_Base() { ; }
 
   int GetLineNum() const { return line_num; }
-  int GetNumArgs() { return (arg1?1:0)+(arg2?1:0)+(arg3?1:0); }
+  void ShiftLineNum(int shift) { line_num += shift; }
+  int GetNumArgs() { return (arg1?1:0)+(arg2?1:0)+(arg3?1:0)+(arg4?1:0); }
   cInstArg_Base * GetArg1() { return arg1; }
   cInstArg_Base * GetArg2() { return arg2; }
   cInstArg_Base * GetArg3() { return arg3; }
+  cInstArg_Base * GetArg4() { return arg4; }
 
   std::string GetArg1String() const { return arg1 ? arg1->VerboseString() : ""; }
   std::string GetArg2String() const { return arg2 ? arg2->VerboseString() : ""; }
   std::string GetArg3String() const { return arg3 ? arg3->VerboseString() : ""; }
+  std::string GetArg4String() const { return arg4 ? arg4->VerboseString() : ""; }
 
   std::string GetArgString(int id) const {
     if (id == 0) return arg1 ? arg1->VerboseString() : "";
     if (id == 1) return arg2 ? arg2->VerboseString() : "";
     if (id == 2) return arg3 ? arg3->VerboseString() : "";
+    if (id == 3) return arg4 ? arg4->VerboseString() : "";
     return "";
   }
 
@@ -191,15 +251,37 @@ public:
   virtual int GetCost() const { return 1; }
   virtual bool Run() { return false; }
   
+  cHardware * GetHardware() const { return hardware; }
+  // Copy of this instruction built in arena, with copies of its arguments, so that a program
+  // that stops being shared doesn't change the instructions of the one it was copied from.
+  virtual cInst_Base * Clone(cArena & arena) const = 0;
+
+  void Relink() {
+    if (arg1 != NULL) arg1->Relink();
+    if (arg2 != NULL) arg2->Relink();
+    if (arg3 != NULL) arg3->Relink();
+    if (arg4 != NULL) arg4->Relink();
+  }
   void SetHardware(cHardware * _h) {
     hardware = _h;
     if (arg1 != NULL) arg1->SetHardware(_h);
     if (arg2 != NULL) arg2->SetHardware(_h);
     if (arg3 != NULL) arg3->SetHardware(_h);
+    if (arg4 != NULL) arg4->SetHardware(_h);
   }
   
   void PrintString(const std::string & msg);
   void PrintVerbose(const std::string & out_string);
+
+protected:
+  template <typename T> static cInst_Base * CloneAs(cArena & arena, const T & inst) {
+    T * out = arena.New<T>(inst);
+    if (out->arg1 != NULL) out->arg1 = out->arg1->Clone(arena);
+    if (out->arg2 != NULL) out->arg2 = out->arg2->Clone(arena);
+    if (out->arg3 != NULL) out->arg3 = out->arg3->Clone(arena);
+    if (out->arg4 != NULL) out->arg4 = out->arg4->Clone(arena);
+    return out;
+  }
 };
 
 class cInst_VAL_COPY : public cInst_Base {
@@ -210,6 +292,7 @@ public:
   ~cInst_VAL_COPY() { ; }
 
   std::string GetName() const { return "val_copy"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "val_copy : Duplicate the value of arg1 into arg2"; }
 
   bool Run() {
@@ -227,6 +310,7 @@ class cInst_ADD : public cInst_Base {
   ~cInst_ADD() { ; }
 
   std::string GetName() const { return "add"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "add : Add the values of arg1 and arg2 and place the sum in arg3"; }
 
   bool Run() {
@@ -244,6 +328,7 @@ public:
   ~cInst_SUB() { ; }
 
   std::string GetName() const { return "sub"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "sub : Subtract the values of arg2 from arg1 and place the difference in arg3"; }
 
   bool Run() {
@@ -261,6 +346,7 @@ public:
   ~cInst_MULT() { ; }
 
   std::string GetName() const { return "mult"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "mult : Multiply the values of arg1 and arg2 and place the product in arg3"; }
 
   bool Run() {
@@ -278,6 +364,7 @@ public:
   ~cInst_DIV() { ; }
 
   std::string GetName() const { return "div"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "div : Divide the value of arg1 by arg2 and place the floor of the ratio in arg3"; }
 
   bool Run();
@@ -291,6 +378,7 @@ public:
   ~cInst_MOD() { ; }
 
   std::string GetName() const { return "mod"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "mod : Divide the value of arg1 by arg2 and place the *remainder* in arg3"; }
 
   bool Run();
@@ -304,6 +392,7 @@ public:
   ~cInst_TEST_LESS() { ; }
 
   std::string GetName() const { return "test_less"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "test_less : If (arg1 < arg2), arg3 is set to 1, else arg3 is set to 0"; }
 
   bool Run() {
@@ -321,6 +410,7 @@ public:
   ~cInst_TEST_GTR() { ; }
 
   std::string GetName() const { return "test_gtr"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "test_gtr : If (arg1 > arg2), arg3 is set to 1, else arg3 is set to 0"; }
 
   bool Run() {
@@ -338,6 +428,7 @@ public:
   ~cInst_TEST_EQU() { ; }
 
   std::string GetName() const { return "test_equ"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "test_equ : If (arg1 == arg2), arg3 is set to 1, else arg3 is set to 0"; }
 
   bool Run() {
@@ -355,6 +446,7 @@ public:
   ~cInst_TEST_NEQU() { ; }
 
   std::string GetName() const { return "test_nequ"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "test_nequ : If (arg1 != arg2), arg3 is set to 1, else arg3 is set to 0"; }
 
   bool Run() {
@@ -372,6 +464,7 @@ public:
   ~cInst_TEST_GTE() { ; }
 
   std::string GetName() const { return "test_gte"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "test_gte : If (arg1 >= arg2), arg3 is set to 1, else arg3 is set to 0"; }
 
   bool Run() {
@@ -389,6 +482,7 @@ public:
   ~cInst_TEST_LTE() { ; }
 
   std::string GetName() const { return "test_lte"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "test_lte : If (arg1 <= arg2), arg3 is set to 1, else arg3 is set to 0"; }
 
   bool Run() {
@@ -406,6 +500,7 @@ public:
   ~cInst_JUMP() { ; }
 
   std::string GetName() const { return "jump"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "jump : Jump IP to position designated by arg1"; }
 
   bool Run();
@@ -421,6 +516,7 @@ public:
   ~cInst_JUMP_IF_0() { ; }
 
   std::string GetName() const { return "jump_if_0"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "jump_if_0 : If arg1 == 0, Jump IP to position designated by arg2"; }
 
   bool Run();
@@ -434,11 +530,39 @@ public:
   ~cInst_JUMP_IF_N0() { ; }
 
   std::string GetName() const { return "jump_if_n0"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "jump_if_n0 : If arg1 != 0, Jump IP to position designated by arg2"; }
 
   bool Run();
 };
 
+class cInst_CALL : public cInst_Base {
+private:
+public:
+  cInst_CALL(int ln, cInstArg_Base * _a1)
+    : cInst_Base(ln, _a1) { ; }
+  ~cInst_CALL() { ; }
+
+  std::string GetName() const { return "call"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "call : Jump IP to position designated by arg1, saving the next position for ret"; }
+
+  bool Run();
+};
+
+class cInst_RET : public cInst_Base {
+private:
+public:
+  cInst_RET(int ln) : cInst_Base(ln) { ; }
+  ~cInst_RET() { ; }
+
+  std::string GetName() const { return "ret"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "ret : Jump IP back to the position after the most recent call"; }
+
+  bool Run();
+};
+
 class cInst_NOP : public cInst_Base {
 private:
 public:
@@ -446,6 +570,7 @@ public:
   ~cInst_NOP() { ; }
 
   std::string GetName() const { return "nop"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "nop : No-operation."; }
   int GetCost() const { return 0; }
 
@@ -463,6 +588,7 @@ public:
   ~cInst_RANDOM() { ; }
 
   std::string GetName() const { return "random"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "random : set arg2 to a random value x, where 0 <= x < arg1."; }
 
   bool Run();
@@ -476,6 +602,7 @@ public:
   ~cInst_OUT_INT() { ; }
 
   std::string GetName() const { return "out_int"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "out_int : Print out arg1 as an integer"; }
 
   bool Run();
@@ -489,6 +616,7 @@ public:
   ~cInst_OUT_FLOAT() { ; }
 
   std::string GetName() const { return "out_float"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "out_float : Print out arg1 as a floating-point number"; }
 
   bool Run();
@@ -502,6 +630,7 @@ public:
   ~cInst_OUT_CHAR() { ; }
 
   std::string GetName() const { return "out_char"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "out_char : Print out arg1 as a character"; }
 
   bool Run();
@@ -515,6 +644,7 @@ public:
   ~cInst_PUSH_NUM() { ; }
 
   std::string GetName() const { return "push"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "push : Store arg1 in an internal control stack"; }
 
   bool Run();
@@ -528,6 +658,7 @@ public:
   ~cInst_PUSH_ARRAY() { ; }
 
   std::string GetName() const { return "ar_push"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "ar_push : Store array arg1 in an internal control stack"; }
 
   bool Run();
@@ -541,6 +672,7 @@ public:
   ~cInst_POP_NUM() { ; }
 
   std::string GetName() const { return "pop"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "pop : Retrieve arg1 from an internal control stack"; }
 
   bool Run();
@@ -554,6 +686,7 @@ public:
   ~cInst_POP_ARRAY() { ; }
 
   std::string GetName() const { return "ar_pop"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "ar_pop : Retrieve array arg1 from an internal control stack"; }
 
   bool Run();
@@ -567,6 +700,7 @@ public:
   ~cInst_AR_GET_IDX() { ; }
 
   std::string GetName() const { return "ar_get_idx"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "ar_get_idx : In array arg1, find value @ index arg2, and put result in arg3"; }
 
   bool Run();
@@ -580,6 +714,7 @@ public:
   ~cInst_AR_SET_IDX() { ; }
 
   std::string GetName() const { return "ar_set_idx"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "ar_set_idx : In array arg1, set value @ index arg2 to value arg3"; }
 
   bool Run();
@@ -593,6 +728,7 @@ public:
   ~cInst_AR_GET_SIZ() { ; }
 
   std::string GetName() const { return "ar_get_siz"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "ar_get_siz : Calculate size of array arg1 and put result in arg2"; }
 
   bool Run();
@@ -606,6 +742,7 @@ public:
   ~cInst_AR_SET_SIZ() { ; }
 
   std::string GetName() const { return "ar_set_siz"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "ar_set_siz : Resize array arg1 to arg2"; }
 
   bool Run();
@@ -619,11 +756,152 @@ public:
   ~cInst_AR_COPY() { ; }
 
   std::string GetName() const { return "ar_copy"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "ar_copy : Duplicate the value in array arg1 to array arg2"; }
 
   bool Run();
 };
 
+class cInst_AR_ADD : public cInst_Base {
+private:
+public:
+  cInst_AR_ADD(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2, cInstArg_Base * _a3)
+    : cInst_Base(ln, _a1, _a2, _a3) { ; }
+  ~cInst_AR_ADD() { ; }
+
+  std::string GetName() const { return "ar_add"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "ar_add : Add array arg1 to array or value arg2, element by element, placing the result in array arg3"; }
+
+  bool Run();
+};
+
+class cInst_AR_SUB : public cInst_Base {
+private:
+public:
+  cInst_AR_SUB(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2, cInstArg_Base * _a3)
+    : cInst_Base(ln, _a1, _a2, _a3) { ; }
+  ~cInst_AR_SUB() { ; }
+
+  std::string GetName() const { return "ar_sub"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "ar_sub : Subtract array or value arg2 from array arg1, element by element, placing the result in array arg3"; }
+
+  bool Run();
+};
+
+class cInst_AR_MULT : public cInst_Base {
+private:
+public:
+  cInst_AR_MULT(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2, cInstArg_Base * _a3)
+    : cInst_Base(ln, _a1, _a2, _a3) { ; }
+  ~cInst_AR_MULT() { ; }
+
+  std::string GetName() const { return "ar_mult"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "ar_mult : Multiply array arg1 by array or value arg2, element by element, placing the result in array arg3"; }
+
+  bool Run();
+};
+
+class cInst_AR_FILL : public cInst_Base {
+private:
+public:
+  cInst_AR_FILL(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2)
+    : cInst_Base(ln, _a1, _a2) { ; }
+  ~cInst_AR_FILL() { ; }
+
+  std::string GetName() const { return "ar_fill"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "ar_fill : Set every element of array arg1 to value arg2"; }
+
+  bool Run();
+};
+
+class cInst_AR_SUM : public cInst_Base {
+private:
+public:
+  cInst_AR_SUM(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2)
+    : cInst_Base(ln, _a1, _a2) { ; }
+  ~cInst_AR_SUM() { ; }
+
+  std::string GetName() const { return "ar_sum"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "ar_sum : Add up all of the elements of array arg1 and put the total in arg2"; }
+
+  bool Run();
+};
+
+class cInst_AR_MIN : public cInst_Base {
+private:
+public:
+  cInst_AR_MIN(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2)
+    : cInst_Base(ln, _a1, _a2) { ; }
+  ~cInst_AR_MIN() { ; }
+
+  std::string GetName() const { return "ar_min"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "ar_min : Find the smallest element of array arg1 and put it in arg2"; }
+
+  bool Run();
+};
+
+class cInst_AR_MAX : public cInst_Base {
+private:
+public:
+  cInst_AR_MAX(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2)
+    : cInst_Base(ln, _a1, _a2) { ; }
+  ~cInst_AR_MAX() { ; }
+
+  std::string GetName() const { return "ar_max"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "ar_max : Find the largest element of array arg1 and put it in arg2"; }
+
+  bool Run();
+};
+
+class cInst_AR_DOT : public cInst_Base {
+private:
+public:
+  cInst_AR_DOT(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2, cInstArg_Base * _a3)
+    : cInst_Base(ln, _a1, _a2, _a3) { ; }
+  ~cInst_AR_DOT() { ; }
+
+  std::string GetName() const { return "ar_dot"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "ar_dot : Multiply arrays arg1 and arg2 element by element and put the sum of the products in arg3"; }
+
+  bool Run();
+};
+
+class cInst_AR_COPY_RANGE : public cInst_Base {
+private:
+public:
+  cInst_AR_COPY_RANGE(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2, cInstArg_Base * _a3)
+    : cInst_Base(ln, _a1, _a2, _a3) { ; }
+  ~cInst_AR_COPY_RANGE() { ; }
+
+  std::string GetName() const { return "ar_copy_range"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "ar_copy_range : Fill array arg3 with elements of array arg1, starting at index arg2"; }
+
+  bool Run();
+};
+
+class cInst_AR_SORT : public cInst_Base {
+private:
+public:
+  cInst_AR_SORT(int ln, cInstArg_Base * _a1)
+    : cInst_Base(ln, _a1) { ; }
+  ~cInst_AR_SORT() { ; }
+
+  std::string GetName() const { return "ar_sort"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "ar_sort : Sort the elements of array arg1 from smallest to largest"; }
+
+  bool Run();
+};
+
 class cInst_LOAD : public cInst_Base {
 private:
 public:
@@ -632,6 +910,7 @@ public:
   ~cInst_LOAD() { ; }
 
   std::string GetName() const { return "load"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "load : Copy from memory position arg1 into register arg2"; }
 
   bool Run();
@@ -646,6 +925,7 @@ public:
   ~cInst_STORE() { ; }
 
   std::string GetName() const { return "store"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "store : Copy from register arg1 into memory position arg2"; }
 
   bool Run();
@@ -660,12 +940,73 @@ public:
   ~cInst_MEM_COPY() { ; }
 
   std::string GetName() const { return "mem_copy"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "mem_copy : Copy from memory position arg1 to memory position arg2"; }
 
   bool Run();
   int GetCost() const { return 100; }
 };
 
+class cInst_MEM_FILL : public cInst_Base {
+private:
+public:
+  cInst_MEM_FILL(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2, cInstArg_Base * _a3)
+    : cInst_Base(ln, _a1, _a2, _a3) { ; }
+  ~cInst_MEM_FILL() { ; }
+
+  std::string GetName() const { return "mem_fill"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "mem_fill : Copy value arg1 into arg3 memory positions, starting at position arg2"; }
+
+  bool Run();
+  int GetCost() const { return 100; }
+};
+
+class cInst_MEM_BLOCK_COPY : public cInst_Base {
+private:
+public:
+  cInst_MEM_BLOCK_COPY(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2, cInstArg_Base * _a3)
+    : cInst_Base(ln, _a1, _a2, _a3) { ; }
+  ~cInst_MEM_BLOCK_COPY() { ; }
+
+  std::string GetName() const { return "mem_block_copy"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "mem_block_copy : Copy arg3 memory positions starting at arg1 to the positions starting at arg2 (ranges may overlap)"; }
+
+  bool Run();
+  int GetCost() const { return 100; }
+};
+
+class cInst_MEM_COMPARE : public cInst_Base {
+private:
+public:
+  cInst_MEM_COMPARE(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2, cInstArg_Base * _a3, cInstArg_Base * _a4)
+    : cInst_Base(ln, _a1, _a2, _a3, _a4) { ; }
+  ~cInst_MEM_COMPARE() { ; }
+
+  std::string GetName() const { return "mem_compare"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "mem_compare : Compare arg3 memory positions starting at arg1 and arg2; set arg4 to -1, 0, or 1 based on the first that differ"; }
+
+  bool Run();
+  int GetCost() const { return 100; }
+};
+
+class cInst_MEM_SUM : public cInst_Base {
+private:
+public:
+  cInst_MEM_SUM(int ln, cInstArg_Base * _a1, cInstArg_Base * _a2, cInstArg_Base * _a3)
+    : cInst_Base(ln, _a1, _a2, _a3) { ; }
+  ~cInst_MEM_SUM() { ; }
+
+  std::string GetName() const { return "mem_sum"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "mem_sum : Add up arg2 memory positions starting at arg1, and place the total in register arg3"; }
+
+  bool Run();
+  int GetCost() const { return 100; }
+};
+
 class cInst_DEBUG_STATUS : public cInst_Base {
 private:
 public:
@@ -674,10 +1015,54 @@ public:
   ~cInst_DEBUG_STATUS() { ; }
 
   std::string GetName() const { return "debug_status"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
   static std::string GetDesc() { return "debug_status : if in debug mode, print the status of all registers and memory"; }
 
   bool Run();
   int GetCost() const { return 0; }
 };
 
+// Placed after the program and after each module linked in with it (see module.h), so that
+// running off the end of one stops the program as running off the end of its file would.
+class cInst_END : public cInst_Base {
+private:
+public:
+  cInst_END(int ln)
+    : cInst_Base(ln) { ; }
+  ~cInst_END() { ; }
+
+  std::string GetName() const { return "end"; }
+  cInst_Base * Clone(cArena & arena) const { return CloneAs(arena, *this); }
+  static std::string GetDesc() { return "end : Stop the program (placed at the end of linked code)"; }
+
+  bool Run();
+  int GetCost() const { return 0; }
+};
+
+// Test deciding whether a conditional breakpoint should stop execution.
+typedef std::function<bool(cHardware &)> tBreakCondition;
+
+// Trap patched over an instruction to set a breakpoint on it; the original is kept aside and
+// run in its place whenever the trap doesn't stop execution.  Only patched instructions pay
+// for breakpoints, so a program without any runs at full speed.
+class cInst_BREAK : public cInst_Base {
+private:
+  cInst_Base * inst;            // Original instruction.
+  tBreakCondition condition;    // Stop only when this is true (always stop if empty).
+public:
+  cInst_BREAK(cInst_Base * _inst, const tBreakCondition & _cond)
+    : cInst_Base(_inst->GetLineNum(), _inst->GetArg1(), _inst->GetArg2(), _inst->GetArg3(), _inst->GetArg4())
+    , inst(_inst), condition(_cond) { ; }
+  ~cInst_BREAK() { ; }
+
+  cInst_Base * GetOriginal() const { return inst; }
+  void SetCondition(const tBreakCondition & _cond) { condition = _cond; }
+  bool IsConditional() const { return (bool) condition; }
+
+  std::string GetName() const { return inst->GetName(); }
+  int GetCost() const { return inst->GetCost(); }
+  cInst_Base * Clone(cArena & arena) const { return arena.New<cInst_BREAK>(inst->Clone(arena), condition); }
+  bool Run();
+};
+
 #endif
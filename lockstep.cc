@@ -0,0 +1,517 @@
+#include "lockstep.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+  enum OpType { OP_VAL_COPY=0, OP_ADD, OP_SUB, OP_MULT, OP_DIV, OP_MOD,
+                OP_TEST_LESS, OP_TEST_GTR, OP_TEST_EQU, OP_TEST_NEQU, OP_TEST_GTE, OP_TEST_LTE,
+                OP_JUMP, OP_JUMP_IF_0, OP_JUMP_IF_N0, OP_CALL, OP_RET, OP_NOP, OP_RANDOM,
+                OP_OUT_INT, OP_OUT_FLOAT, OP_OUT_CHAR, OP_LOAD, OP_STORE, OP_MEM_COPY,
+                OP_MEM_FILL, OP_MEM_BLOCK_COPY, OP_MEM_COMPARE, OP_MEM_SUM, OP_END };
+
+  struct cOpInfo {
+    const char * name;
+    int type;
+    int dest;    // Which argument is written to (-1 for none).
+  };
+
+  const cOpInfo op_info[] = {
+    { "val_copy", OP_VAL_COPY, 1 }, { "add", OP_ADD, 2 }, { "sub", OP_SUB, 2 },
+    { "mult", OP_MULT, 2 }, { "div", OP_DIV, 2 }, { "mod", OP_MOD, 2 },
+    { "test_less", OP_TEST_LESS, 2 }, { "test_gtr", OP_TEST_GTR, 2 },
+    { "test_equ", OP_TEST_EQU, 2 }, { "test_nequ", OP_TEST_NEQU, 2 },
+    { "test_gte", OP_TEST_GTE, 2 }, { "test_lte", OP_TEST_LTE, 2 },
+    { "jump", OP_JUMP, -1 }, { "jump_if_0", OP_JUMP_IF_0, -1 }, { "jump_if_n0", OP_JUMP_IF_N0, -1 },
+    { "call", OP_CALL, -1 }, { "ret", OP_RET, -1 }, { "nop", OP_NOP, -1 },
+    { "debug_status", OP_NOP, -1 }, { "random", OP_RANDOM, 1 },
+    { "out_int", OP_OUT_INT, -1 }, { "out_float", OP_OUT_FLOAT, -1 }, { "out_char", OP_OUT_CHAR, -1 },
+    { "load", OP_LOAD, 1 }, { "store", OP_STORE, -1 }, { "mem_copy", OP_MEM_COPY, -1 },
+    { "mem_fill", OP_MEM_FILL, -1 }, { "mem_block_copy", OP_MEM_BLOCK_COPY, -1 },
+    { "mem_compare", OP_MEM_COMPARE, 3 }, { "mem_sum", OP_MEM_SUM, 2 }, { "end", OP_END, -1 },
+  };
+  const int num_ops = sizeof(op_info) / sizeof(op_info[0]);
+
+  template <typename T> std::string Format(T value) {
+    std::stringstream ss;
+    ss << value;
+    return ss.str();
+  }
+}
+
+
+cLockstep::cLockstep(cHardware & hardware, int _lanes)
+  : num_lanes(_lanes), mem_size(hardware.GetMemArray().size()), timeout(hardware.GetTimeout())
+  , call_limit(hardware.GetCallLimit()), regs(NUM_REGS * _lanes, 0.0f), mem_pages(hardware.GetMemArray().GetNumPages())
+  , lane_IP(_lanes, 0), exe_count(_lanes, 0), halt_type(_lanes, HALT_NONE), exit_code(_lanes, 0)
+  , random(_lanes, cRandom(hardware.GetSeed())), call_stack(_lanes), output(_lanes)
+{
+  // Translate the program into flat operations, so no instruction objects are touched while running.
+  for (int inst_id = 0; inst_id < hardware.GetNumInsts(); inst_id++) {
+    cInst_Base * inst = hardware.GetInst(inst_id);
+    const std::string name = inst->GetName();
+    int info_id = 0;
+    while (info_id < num_ops && name != op_info[info_id].name) info_id++;
+    if (info_id == num_ops) {
+      std::cerr << "Error(line " << inst->GetLineNum() << "): instruction '" << name
+                << "' is not supported when running in lockstep." << std::endl;
+      exit(1);
+    }
+
+    cOp op;
+    op.type = op_info[info_id].type;
+    op.cost = inst->GetCost();
+    op.args[0] = DecodeArg(inst->GetArg1());
+    op.args[1] = DecodeArg(inst->GetArg2());
+    op.args[2] = DecodeArg(inst->GetArg3());
+    op.args[3] = DecodeArg(inst->GetArg4());
+    const int dest = op_info[info_id].dest;
+    if (dest >= 0 && op.args[dest].type != ARG_REG) {
+      std::cerr << "Error(line " << inst->GetLineNum() << "): instruction '" << name
+                << "' can only write to a register when running in lockstep." << std::endl;
+      exit(1);
+    }
+    ops.push_back(op);
+  }
+
+  for (int i = 0; i < 3; i++) scratch[i].resize(num_lanes);
+
+  // Every lane starts together at the first instruction.
+  std::vector<int> & start_group = groups[0];
+  for (int lane = 0; lane < num_lanes; lane++) start_group.push_back(lane);
+}
+
+
+cLockstep::cArg cLockstep::DecodeArg(cInstArg_Base * arg)
+{
+  cArg out = { ARG_NONE, 0, 0 };
+  if (arg == NULL) return out;
+
+  if (cInstArg_Reg * reg_arg = dynamic_cast<cInstArg_Reg *>(arg)) {
+    out.type = ARG_REG;
+    out.reg = reg_arg->GetID();
+  }
+  else if (dynamic_cast<cInstArg_IP *>(arg) != NULL) out.type = ARG_IP;
+  else {
+    out.type = ARG_CONST;           // Numbers, characters, and (resolved) labels.
+    out.value = arg->AsFloat();
+  }
+  return out;
+}
+
+
+// When every lane is in the group, loop over all of them directly so the loop can be vectorized.
+template <typename FUN>
+void cLockstep::ForLanes(const std::vector<int> & lanes, FUN fun)
+{
+  if ((int) lanes.size() == num_lanes) {
+    for (int lane = 0; lane < num_lanes; lane++) fun(lane);
+  } else {
+    for (int i = 0; i < (int) lanes.size(); i++) fun(lanes[i]);
+  }
+}
+
+
+const tValue * cLockstep::Src(const cArg & arg, int slot, int IP, const std::vector<int> & lanes)
+{
+  if (arg.type == ARG_REG) return &regs[arg.reg * num_lanes];
+
+  const tValue value = (arg.type == ARG_IP) ? (tValue) IP : arg.value;
+  tValue * buffer = scratch[slot].data();
+  ForLanes(lanes, [buffer, value](int lane) { buffer[lane] = value; });
+  return buffer;
+}
+
+
+template <typename OP>
+void cLockstep::Binary(const cOp & op, int IP, const std::vector<int> & lanes, OP fun)
+{
+  const tValue * in1 = Src(op.args[0], 0, IP, lanes);
+  const tValue * in2 = Src(op.args[1], 1, IP, lanes);
+  tValue * out = Dst(op.args[2]);
+  ForLanes(lanes, [in1, in2, out, fun](int lane) { out[lane] = fun(in1[lane], in2[lane]); });
+}
+
+
+void cLockstep::Halt(int lane, int type)
+{
+  halt_type[lane] = type;
+  if (exit_code[lane] == 0 && type >= HALT_LOOP) exit_code[lane] = type;
+}
+
+// Errors that would end the whole process in cHardware only end the one lane here.
+void cLockstep::Fatal(int lane, const std::string & msg)
+{
+  Error(lane, msg);
+  exit_code[lane] = 1;
+  Halt(lane, HALT_END);
+}
+
+bool cLockstep::CheckMem(int lane, int pos, int count)
+{
+  if (count < 0) Fatal(lane, "Cannot use a negative count of memory positions");
+  else if (pos < 0) Fatal(lane, "Cannot index into a negative memory position");
+  else if ((long long) pos + count > mem_size) {
+    Fatal(lane, "Limit of " + Format(mem_size) + " memory positions available.");
+  }
+  else return true;
+  return false;
+}
+
+
+// Execute the instruction at IP for every lane in the group, leaving each lane's next IP in lane_IP.
+void cLockstep::Step(int IP, const std::vector<int> & lanes)
+{
+  const cOp & op = ops[IP];
+  const int cost = op.cost;
+  int * next_IP = lane_IP.data();
+  int * cycles = exe_count.data();
+  ForLanes(lanes, [next_IP, cycles, IP, cost](int lane) { next_IP[lane] = IP + 1; cycles[lane] += cost; });
+
+  switch (op.type) {
+  case OP_VAL_COPY: {
+    const tValue * in = Src(op.args[0], 0, IP, lanes);
+    tValue * out = Dst(op.args[1]);
+    ForLanes(lanes, [in, out](int lane) { out[lane] = in[lane]; });
+    break;
+  }
+  case OP_ADD:  Binary(op, IP, lanes, [](tValue a, tValue b) { return a + b; }); break;
+  case OP_SUB:  Binary(op, IP, lanes, [](tValue a, tValue b) { return a - b; }); break;
+  case OP_MULT: Binary(op, IP, lanes, [](tValue a, tValue b) { return a * b; }); break;
+  case OP_TEST_LESS: Binary(op, IP, lanes, [](tValue a, tValue b) { return (tValue) (a < b); }); break;
+  case OP_TEST_GTR:  Binary(op, IP, lanes, [](tValue a, tValue b) { return (tValue) (a > b); }); break;
+  case OP_TEST_EQU:  Binary(op, IP, lanes, [](tValue a, tValue b) { return (tValue) (a == b); }); break;
+  case OP_TEST_NEQU: Binary(op, IP, lanes, [](tValue a, tValue b) { return (tValue) (a != b); }); break;
+  case OP_TEST_GTE:  Binary(op, IP, lanes, [](tValue a, tValue b) { return (tValue) (a >= b); }); break;
+  case OP_TEST_LTE:  Binary(op, IP, lanes, [](tValue a, tValue b) { return (tValue) (a <= b); }); break;
+
+  case OP_DIV:
+  case OP_MOD: {
+    // Check for zeros first, so the common case is a plain loop with no per-lane branches.
+    const tValue * in1 = Src(op.args[0], 0, IP, lanes);
+    const tValue * in2 = Src(op.args[1], 1, IP, lanes);
+    tValue * out = Dst(op.args[2]);
+    const bool is_div = (op.type == OP_DIV);
+    bool any_zero = false;
+    ForLanes(lanes, [in2, is_div, &any_zero](int lane) {
+        any_zero |= is_div ? (in2[lane] == 0) : ((tInt) in2[lane] == 0);
+      });
+    if (!any_zero && is_div) {
+      ForLanes(lanes, [in1, in2, out](int lane) { out[lane] = DivValues(in1[lane], in2[lane]); });
+    } else if (!any_zero) {
+      ForLanes(lanes, [in1, in2, out](int lane) { out[lane] = (tValue) ModInts((tInt) in1[lane], (tInt) in2[lane]); });
+    } else {
+      ForLanes(lanes, [this, in1, in2, out, is_div](int lane) {
+          if (is_div && in2[lane] == 0) Error(lane, "div: Division by Zero");
+          else if (!is_div && (tInt) in2[lane] == 0) Error(lane, "mod: Division by Zero");
+          else if (is_div) out[lane] = DivValues(in1[lane], in2[lane]);
+          else out[lane] = (tValue) ModInts((tInt) in1[lane], (tInt) in2[lane]);
+        });
+    }
+    break;
+  }
+
+  case OP_JUMP:
+  case OP_CALL: {
+    const tValue * target = Src(op.args[0], 0, IP, lanes);
+    if (op.type == OP_CALL) {
+      ForLanes(lanes, [this, IP](int lane) {
+          if (call_limit >= 0 && (int) call_stack[lane].size() >= call_limit) {
+            Print(lane, "Call stack overflow (limit of " + Format(call_limit) + " nested calls).  Halting.\n");
+            Halt(lane, HALT_CALL_STACK);
+          }
+          else call_stack[lane].push_back(IP + 1);
+        });
+    }
+    ForLanes(lanes, [next_IP, target](int lane) { next_IP[lane] = (int) target[lane]; });
+    break;
+  }
+  case OP_JUMP_IF_0:
+  case OP_JUMP_IF_N0: {
+    const tValue * test = Src(op.args[0], 0, IP, lanes);
+    const tValue * target = Src(op.args[1], 1, IP, lanes);
+    const bool if_zero = (op.type == OP_JUMP_IF_0);
+    ForLanes(lanes, [next_IP, test, target, if_zero](int lane) {
+        if ((test[lane] == 0) == if_zero) next_IP[lane] = (int) target[lane];
+      });
+    break;
+  }
+  case OP_RET:
+    ForLanes(lanes, [this, next_IP](int lane) {
+        if (call_stack[lane].size() == 0) {
+          Error(lane, "ret: Return without a matching call.");
+          Halt(lane, HALT_CALL_STACK);
+          return;
+        }
+        next_IP[lane] = call_stack[lane].back();
+        call_stack[lane].pop_back();
+      });
+    break;
+
+  case OP_NOP:
+    break;
+  case OP_END:
+    ForLanes(lanes, [this](int lane) { Halt(lane, HALT_END); });
+    break;
+  case OP_RANDOM: {
+    const tValue * limit = Src(op.args[0], 0, IP, lanes);
+    tValue * out = Dst(op.args[1]);
+    ForLanes(lanes, [this, limit, out](int lane) {
+        const int rand_max = (int) limit[lane];
+        if (rand_max <= 0) Error(lane, "random: must have a positive upper limit");
+        else out[lane] = (tValue) (random[lane].Next() % rand_max);
+      });
+    break;
+  }
+
+  case OP_OUT_INT: {
+    const tValue * in = Src(op.args[0], 0, IP, lanes);
+    ForLanes(lanes, [this, in](int lane) { Print(lane, Format((tInt) in[lane])); });
+    break;
+  }
+  case OP_OUT_FLOAT: {
+    const tValue * in = Src(op.args[0], 0, IP, lanes);
+    ForLanes(lanes, [this, in](int lane) { Print(lane, Format(in[lane])); });
+    break;
+  }
+  case OP_OUT_CHAR: {
+    const tValue * in = Src(op.args[0], 0, IP, lanes);
+    ForLanes(lanes, [this, in](int lane) { output[lane] += (char) (int) in[lane]; });
+    break;
+  }
+
+  case OP_LOAD: {
+    tValue * out = Dst(op.args[1]);
+    if (op.args[0].type == ARG_CONST && op.args[0].value >= 0 && (int) op.args[0].value < mem_size) {
+      // A fixed address reads one contiguous row across the lanes.
+      const tValue * row = MemRow((int) op.args[0].value);
+      ForLanes(lanes, [row, out](int lane) { out[lane] = row[lane]; });
+      break;
+    }
+    const tValue * addr = Src(op.args[0], 0, IP, lanes);
+    ForLanes(lanes, [this, addr, out](int lane) {
+        const int pos = (int) addr[lane];
+        if (CheckMem(lane, pos)) out[lane] = GetMem(pos, lane);
+      });
+    break;
+  }
+  case OP_STORE: {
+    const tValue * in = Src(op.args[0], 0, IP, lanes);
+    if (op.args[1].type == ARG_CONST && op.args[1].value >= 0 && (int) op.args[1].value < mem_size) {
+      tValue * row = MemRow((int) op.args[1].value);
+      ForLanes(lanes, [row, in](int lane) { row[lane] = in[lane]; });
+      break;
+    }
+    const tValue * addr = Src(op.args[1], 1, IP, lanes);
+    ForLanes(lanes, [this, addr, in](int lane) {
+        const int pos = (int) addr[lane];
+        if (CheckMem(lane, pos)) MemRow(pos)[lane] = in[lane];
+      });
+    break;
+  }
+  case OP_MEM_COPY: {
+    const tValue * from = Src(op.args[0], 0, IP, lanes);
+    const tValue * to = Src(op.args[1], 1, IP, lanes);
+    ForLanes(lanes, [this, from, to](int lane) {
+        const int from_pos = (int) from[lane], to_pos = (int) to[lane];
+        if (CheckMem(lane, from_pos) && CheckMem(lane, to_pos)) MemRow(to_pos)[lane] = GetMem(from_pos, lane);
+      });
+    break;
+  }
+
+  // Bulk memory instructions work on different ranges in each lane, so each lane runs separately.
+  case OP_MEM_FILL: {
+    const tValue * value = Src(op.args[0], 0, IP, lanes);
+    const tValue * start = Src(op.args[1], 1, IP, lanes);
+    const tValue * count = Src(op.args[2], 2, IP, lanes);
+    ForLanes(lanes, [this, value, start, count, cycles](int lane) {
+        const int pos = (int) start[lane], num = (int) count[lane];
+        if (!CheckMem(lane, pos, num)) return;
+        for (int i = 0; i < num; i++) MemRow(pos + i)[lane] = value[lane];
+        cycles[lane] = cHardware::AddCycles(cycles[lane], (long long) num * cHardware::MEM_CYCLES_PER_POSITION);
+      });
+    break;
+  }
+  case OP_MEM_BLOCK_COPY: {
+    const tValue * from = Src(op.args[0], 0, IP, lanes);
+    const tValue * to = Src(op.args[1], 1, IP, lanes);
+    const tValue * count = Src(op.args[2], 2, IP, lanes);
+    ForLanes(lanes, [this, from, to, count, cycles](int lane) {
+        const int from_pos = (int) from[lane], to_pos = (int) to[lane], num = (int) count[lane];
+        if (!CheckMem(lane, from_pos, num) || !CheckMem(lane, to_pos, num)) return;
+        if (to_pos < from_pos) {
+          for (int i = 0; i < num; i++) MemRow(to_pos + i)[lane] = GetMem(from_pos + i, lane);
+        } else {
+          for (int i = num - 1; i >= 0; i--) MemRow(to_pos + i)[lane] = GetMem(from_pos + i, lane);
+        }
+        cycles[lane] = cHardware::AddCycles(cycles[lane], (long long) num * cHardware::MEM_CYCLES_PER_POSITION);
+      });
+    break;
+  }
+  case OP_MEM_COMPARE: {
+    const tValue * pos1 = Src(op.args[0], 0, IP, lanes);
+    const tValue * pos2 = Src(op.args[1], 1, IP, lanes);
+    const tValue * count = Src(op.args[2], 2, IP, lanes);
+    tValue * out = Dst(op.args[3]);
+    ForLanes(lanes, [this, pos1, pos2, count, out, cycles](int lane) {
+        const int p1 = (int) pos1[lane], p2 = (int) pos2[lane], num = (int) count[lane];
+        if (!CheckMem(lane, p1, num) || !CheckMem(lane, p2, num)) return;
+        int result = 0;
+        for (int i = 0; i < num && result == 0; i++) {
+          const tValue v1 = GetMem(p1 + i, lane), v2 = GetMem(p2 + i, lane);
+          if (v1 != v2) result = (v1 < v2) ? -1 : 1;
+        }
+        cycles[lane] = cHardware::AddCycles(cycles[lane], (long long) num * cHardware::MEM_CYCLES_PER_POSITION);
+        out[lane] = (tValue) result;
+      });
+    break;
+  }
+  case OP_MEM_SUM: {
+    const tValue * start = Src(op.args[0], 0, IP, lanes);
+    const tValue * count = Src(op.args[1], 1, IP, lanes);
+    tValue * out = Dst(op.args[2]);
+    ForLanes(lanes, [this, start, count, out, cycles](int lane) {
+        const int pos = (int) start[lane], num = (int) count[lane];
+        if (!CheckMem(lane, pos, num)) return;
+        // Partial sums by position mod 8, combined in order, exactly as cMemory::Sum does.
+        tValue partial[8] = { 0 };
+        for (int i = pos; i < pos + num; i++) partial[i & 7] += GetMem(i, lane);
+        tValue total = partial[0];
+        for (int j = 1; j < 8; j++) total += partial[j];
+        cycles[lane] = cHardware::AddCycles(cycles[lane], (long long) num * cHardware::MEM_CYCLES_PER_POSITION);
+        out[lane] = total;
+      });
+    break;
+  }
+  }
+
+  if (timeout >= 0) {
+    ForLanes(lanes, [this](int lane) {
+        if (exe_count[lane] >= timeout && halt_type[lane] == HALT_NONE) {
+          Print(lane, "Reached execution count limit of " + Format(timeout) + ".  Halting.\n");
+          Halt(lane, HALT_TIMEOUT);
+        }
+      });
+  }
+}
+
+
+// A lane with no others at its IP runs alone until it catches up with another group (or halts).
+void cLockstep::RunScalar(int lane)
+{
+  const std::vector<int> lanes(1, lane);
+  for (int step = 0; step < SCALAR_BURST; step++) {
+    const int IP = lane_IP[lane];
+    if (IP < 0 || IP >= (int) ops.size()) {
+      Halt(lane, HALT_END);
+      return;
+    }
+    Step(IP, lanes);
+    if (halt_type[lane] != HALT_NONE) return;
+    if (groups.count(lane_IP[lane])) break;
+  }
+  groups[lane_IP[lane]].push_back(lane);
+}
+
+
+void cLockstep::Run()
+{
+  while (groups.size() > 0) {
+    std::map<int, std::vector<int> >::iterator group_it = groups.begin();
+    const int IP = group_it->first;
+    std::vector<int> lanes;
+    lanes.swap(group_it->second);
+    groups.erase(group_it);
+
+    if (IP < 0 || IP >= (int) ops.size()) {
+      for (int i = 0; i < (int) lanes.size(); i++) Halt(lanes[i], HALT_END);
+      continue;
+    }
+    if (lanes.size() == 1) {
+      RunScalar(lanes[0]);
+      continue;
+    }
+
+    Step(IP, lanes);
+
+    // Usually every lane moves on to the same place and the group stays together.
+    const int next_IP = lane_IP[lanes[0]];
+    bool together = true;
+    for (int i = 0; i < (int) lanes.size() && together; i++) {
+      together = (lane_IP[lanes[i]] == next_IP && halt_type[lanes[i]] == HALT_NONE);
+    }
+    if (together) {
+      std::vector<int> & next_group = groups[next_IP];
+      if (next_group.size() == 0) next_group.swap(lanes);
+      else next_group.insert(next_group.end(), lanes.begin(), lanes.end());
+      continue;
+    }
+    for (int i = 0; i < (int) lanes.size(); i++) {
+      if (halt_type[lanes[i]] == HALT_NONE) groups[lane_IP[lanes[i]]].push_back(lanes[i]);
+    }
+  }
+}
+
+
+// Options set on hardware that lockstep runs have no equivalent for ("" if none); these are
+// refused rather than silently ignored.
+static std::string UnsupportedOption(const cHardware & hardware)
+{
+  if (hardware.GetOutputLimit() >= 0) return "-o";
+  if (hardware.GetMemPageLimit() >= 0) return "-p";
+  if (hardware.GetWallTimeLimit() >= 0) return "-w";
+  if (hardware.GetLoopCheck() > 0) return "-l";
+  if (hardware.IsVerbose()) return "-v";
+  if (!hardware.IsRepeatable()) return "-b, -g, -k or -r";
+  return "";
+}
+
+int RunLockstepFile(cHardware & hardware, const std::string & filename)
+{
+  const std::string option = UnsupportedOption(hardware);
+  if (option.size() > 0) {
+    std::cerr << "Error: " << option << " cannot be used together with -m." << std::endl;
+    exit(1);
+  }
+
+  std::ifstream in(filename.c_str());
+  if (!in) {
+    std::cerr << "Error: unable to open input file '" << filename << "'." << std::endl;
+    exit(1);
+  }
+
+  // Each non-blank line that is not a comment is one memory image.
+  std::vector<std::vector<tValue> > images;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::stringstream ss(line);
+    std::vector<tValue> image;
+    tValue value;
+    while (ss >> value) image.push_back(value);
+    if (line.find_first_not_of(" \t\r") == std::string::npos || line[line.find_first_not_of(" \t\r")] == '#') continue;
+    images.push_back(image);
+  }
+  if (images.size() == 0) return 0;
+
+  cLockstep lockstep(hardware, (int) images.size());
+  for (int lane = 0; lane < (int) images.size(); lane++) {
+    if ((int) images[lane].size() > hardware.GetMemArray().size()) {
+      std::cerr << "Error: input " << (lane+1) << " does not fit in memory." << std::endl;
+      exit(1);
+    }
+    for (int pos = 0; pos < (int) images[lane].size(); pos++) lockstep.SetMem(lane, pos, images[lane][pos]);
+  }
+  lockstep.Run();
+
+  int exit_code = 0;
+  for (int lane = 0; lane < lockstep.GetNumLanes(); lane++) {
+    std::cout << "=== Input " << (lane+1) << " ===" << std::endl << lockstep.GetOutput(lane);
+    if (hardware.IsCountingCycles() && lockstep.GetExitCode(lane) != 1) {   // As cHardware::Run(); not after an error.
+      std::cout << "[[ Total CPU cycles used: " << lockstep.GetExeCount(lane) << " ]]" << std::endl;
+    }
+    if (exit_code == 0) exit_code = lockstep.GetExitCode(lane);
+  }
+  return exit_code;
+}
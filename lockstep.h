@@ -0,0 +1,101 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "hardware.h"
+
+// Runs many copies ("lanes") of one TubeCode program in lockstep, each starting from its own
+// memory image.  Registers and memory are stored structure-of-arrays -- the values of a register
+// (or memory position) across all lanes are contiguous -- so each instruction is applied to every
+// lane at that IP by a single loop that the compiler can vectorize.
+//
+// Lanes are grouped by IP and the group with the lowest IP runs next, so lanes that split at a
+// conditional jump wait for each other where their paths meet again.  A lane left on its own runs
+// as a plain scalar loop until it reaches an IP where other lanes are waiting.
+class cLockstep {
+private:
+  static const int NUM_REGS = 8;
+  static const int SCALAR_BURST = 4096;   // Steps a lone lane runs before looking for others.
+
+  enum ArgType { ARG_NONE=0, ARG_REG, ARG_CONST, ARG_IP };
+  struct cArg {
+    int type;
+    int reg;
+    tValue value;
+  };
+  struct cOp {
+    int type;
+    int cost;
+    cArg args[4];
+  };
+
+  std::vector<cOp> ops;
+  int num_lanes;
+  int mem_size;
+  int timeout;
+  int call_limit;
+
+  std::vector<tValue> regs;                     // regs[reg * num_lanes + lane]
+  std::vector<std::vector<tValue> > mem_pages;  // [offset * num_lanes + lane]; empty until written.
+  std::vector<int> lane_IP;
+  std::vector<int> exe_count;
+  std::vector<int> halt_type;
+  std::vector<int> exit_code;
+  std::vector<cRandom> random;
+  std::vector<std::vector<int> > call_stack;
+  std::vector<std::string> output;
+
+  std::map<int, std::vector<int> > groups;     // Lanes waiting at each IP.
+  std::vector<tValue> scratch[3];               // Constant operands, broadcast across lanes.
+
+  cArg DecodeArg(cInstArg_Base * arg);
+
+  template <typename FUN> void ForLanes(const std::vector<int> & lanes, FUN fun);
+  template <typename OP> void Binary(const cOp & op, int IP, const std::vector<int> & lanes, OP fun);
+  const tValue * Src(const cArg & arg, int slot, int IP, const std::vector<int> & lanes);
+  tValue * Dst(const cArg & arg) { return &regs[arg.reg * num_lanes]; }
+
+  tValue GetMem(int pos, int lane) const {
+    const std::vector<tValue> & page = mem_pages[pos >> cMemory::PAGE_BITS];
+    return page.size() ? page[(pos & cMemory::PAGE_MASK) * num_lanes + lane] : 0.0f;
+  }
+  tValue * MemRow(int pos) {
+    std::vector<tValue> & page = mem_pages[pos >> cMemory::PAGE_BITS];
+    if (page.size() == 0) page.resize(cMemory::PAGE_SIZE * num_lanes, 0.0f);
+    return &page[(pos & cMemory::PAGE_MASK) * num_lanes];
+  }
+  bool CheckMem(int lane, int pos, int count=1);
+
+  void Print(int lane, const std::string & msg) { output[lane] += msg; }
+  void Error(int lane, const std::string & msg) { output[lane] += "ERROR: " + msg + "\n"; }
+  void Halt(int lane, int type);
+  void Fatal(int lane, const std::string & msg);
+
+  void Step(int IP, const std::vector<int> & lanes);
+  void RunScalar(int lane);
+
+public:
+  cLockstep(cHardware & hardware, int _lanes);
+  ~cLockstep() { ; }
+
+  int GetNumLanes() const { return num_lanes; }
+  void SetTimeout(int _to) { timeout = _to; }
+  void SetMem(int lane, int pos, tValue value) { MemRow(pos)[lane] = value; }
+
+  void Run();
+
+  const std::string & GetOutput(int lane) const { return output[lane]; }
+  int GetExeCount(int lane) const { return exe_count[lane]; }
+  int GetHaltType(int lane) const { return halt_type[lane]; }
+  int GetExitCode(int lane) const { return exit_code[lane]; }
+};
+
+// Run the program in hardware once per line of filename (each line a memory image loaded from
+// position 0), printing the output of each run; returns the first non-zero exit code, if any.
+// Limits lockstep runs can't enforce (output, pages, wall time, loop checks) are refused.
+int RunLockstepFile(cHardware & hardware, const std::string & filename);
+
+#endif
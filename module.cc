@@ -0,0 +1,404 @@
+#include "module.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <sstream>
+
+#include <unistd.h>
+
+namespace {
+  const char image_magic[] = "TUBEMOD2";
+
+  // Building an instruction from its name, for each number of arguments taken.
+  typedef cInst_Base * (*tMakeInst)(cArena & arena, int line_num, cInstArg_Base * const * args);
+  template <typename T> cInst_Base * Make0(cArena & arena, int ln, cInstArg_Base * const *) {
+    return arena.New<T>(ln);
+  }
+  template <typename T> cInst_Base * Make1(cArena & arena, int ln, cInstArg_Base * const * a) {
+    return arena.New<T>(ln, a[0]);
+  }
+  template <typename T> cInst_Base * Make2(cArena & arena, int ln, cInstArg_Base * const * a) {
+    return arena.New<T>(ln, a[0], a[1]);
+  }
+  template <typename T> cInst_Base * Make3(cArena & arena, int ln, cInstArg_Base * const * a) {
+    return arena.New<T>(ln, a[0], a[1], a[2]);
+  }
+  template <typename T> cInst_Base * Make4(cArena & arena, int ln, cInstArg_Base * const * a) {
+    return arena.New<T>(ln, a[0], a[1], a[2], a[3]);
+  }
+
+  struct cInstInfo {
+    const char * name;
+    int num_args;
+    tMakeInst make;
+    int target;    // Argument holding a position to jump to (0 for none).
+  };
+
+  const cInstInfo inst_info[] = {
+    { "val_copy", 2, Make2<cInst_VAL_COPY>, 0 }, { "add", 3, Make3<cInst_ADD>, 0 },
+    { "sub", 3, Make3<cInst_SUB>, 0 }, { "mult", 3, Make3<cInst_MULT>, 0 },
+    { "div", 3, Make3<cInst_DIV>, 0 }, { "mod", 3, Make3<cInst_MOD>, 0 },
+    { "test_less", 3, Make3<cInst_TEST_LESS>, 0 }, { "test_gtr", 3, Make3<cInst_TEST_GTR>, 0 },
+    { "test_equ", 3, Make3<cInst_TEST_EQU>, 0 }, { "test_nequ", 3, Make3<cInst_TEST_NEQU>, 0 },
+    { "test_gte", 3, Make3<cInst_TEST_GTE>, 0 }, { "test_lte", 3, Make3<cInst_TEST_LTE>, 0 },
+    { "jump", 1, Make1<cInst_JUMP>, 1 }, { "jump_if_0", 2, Make2<cInst_JUMP_IF_0>, 2 },
+    { "jump_if_n0", 2, Make2<cInst_JUMP_IF_N0>, 2 }, { "call", 1, Make1<cInst_CALL>, 1 },
+    { "ret", 0, Make0<cInst_RET>, 0 }, { "nop", 0, Make0<cInst_NOP>, 0 },
+    { "random", 2, Make2<cInst_RANDOM>, 0 }, { "out_int", 1, Make1<cInst_OUT_INT>, 0 },
+    { "out_float", 1, Make1<cInst_OUT_FLOAT>, 0 }, { "out_char", 1, Make1<cInst_OUT_CHAR>, 0 },
+    { "push", 1, Make1<cInst_PUSH_NUM>, 0 }, { "ar_push", 1, Make1<cInst_PUSH_ARRAY>, 0 },
+    { "pop", 1, Make1<cInst_POP_NUM>, 0 }, { "ar_pop", 1, Make1<cInst_POP_ARRAY>, 0 },
+    { "ar_get_idx", 3, Make3<cInst_AR_GET_IDX>, 0 }, { "ar_set_idx", 3, Make3<cInst_AR_SET_IDX>, 0 },
+    { "ar_get_siz", 2, Make2<cInst_AR_GET_SIZ>, 0 }, { "ar_set_siz", 2, Make2<cInst_AR_SET_SIZ>, 0 },
+    { "ar_copy", 2, Make2<cInst_AR_COPY>, 0 }, { "ar_add", 3, Make3<cInst_AR_ADD>, 0 },
+    { "ar_sub", 3, Make3<cInst_AR_SUB>, 0 }, { "ar_mult", 3, Make3<cInst_AR_MULT>, 0 },
+    { "ar_fill", 2, Make2<cInst_AR_FILL>, 0 }, { "ar_sum", 2, Make2<cInst_AR_SUM>, 0 },
+    { "ar_min", 2, Make2<cInst_AR_MIN>, 0 }, { "ar_max", 2, Make2<cInst_AR_MAX>, 0 },
+    { "ar_dot", 3, Make3<cInst_AR_DOT>, 0 }, { "ar_copy_range", 3, Make3<cInst_AR_COPY_RANGE>, 0 },
+    { "ar_sort", 1, Make1<cInst_AR_SORT>, 0 }, { "load", 2, Make2<cInst_LOAD>, 0 },
+    { "store", 2, Make2<cInst_STORE>, 0 }, { "mem_copy", 2, Make2<cInst_MEM_COPY>, 0 },
+    { "mem_fill", 3, Make3<cInst_MEM_FILL>, 0 }, { "mem_block_copy", 3, Make3<cInst_MEM_BLOCK_COPY>, 0 },
+    { "mem_compare", 4, Make4<cInst_MEM_COMPARE>, 0 }, { "mem_sum", 3, Make3<cInst_MEM_SUM>, 0 },
+    { "debug_status", 0, Make0<cInst_DEBUG_STATUS>, 0 }, { "end", 0, Make0<cInst_END>, 0 },
+  };
+
+  const cInstInfo * FindInstInfo(const std::string & name)
+  {
+    for (int i = 0; i < (int) (sizeof(inst_info) / sizeof(inst_info[0])); i++) {
+      if (name == inst_info[i].name) return &inst_info[i];
+    }
+    return NULL;
+  }
+
+  // Helpers for reading and writing image fields.
+  void WriteInt(std::ostream & out, long long value) { out.write((const char *) &value, sizeof(value)); }
+  void WriteString(std::ostream & out, const std::string & value) {
+    WriteInt(out, value.size());
+    out.write(value.c_str(), value.size());
+  }
+  long long ReadInt(std::istream & in) { long long value = -1; in.read((char *) &value, sizeof(value)); return value; }
+  std::string ReadString(std::istream & in) {
+    const long long size = ReadInt(in);
+    if (!in || size < 0 || size > (1 << 20)) {
+      in.setstate(std::ios::failbit);
+      return "";
+    }
+    std::string value(size, '\0');
+    if (size > 0) in.read(&value[0], size);
+    return value;
+  }
+
+  bool IsLabelName(const std::string & name)
+  {
+    if (name.size() == 0 || !isalpha((unsigned char) name[0])) return false;
+    for (int i = 1; i < (int) name.size(); i++) {
+      if (!isalnum((unsigned char) name[i]) && name[i] != '_') return false;
+    }
+    return true;
+  }
+
+  void ModuleError(const std::string & path, const std::string & message)
+  {
+    std::cerr << "Error in module " << path << ": " << message << std::endl;
+    exit(2);
+  }
+
+  // 64-bit FNV-1a hash of a module's source.
+  long long HashContents(const std::string & contents)
+  {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int i = 0; i < (int) contents.size(); i++) hash = (hash ^ (unsigned char) contents[i]) * 1099511628211ULL;
+    return (long long) hash;
+  }
+
+  // Images already compiled or loaded by this process, by path.
+  std::map<std::string, std::shared_ptr<const cModuleImage> > & LoadedImages()
+  {
+    static std::map<std::string, std::shared_ptr<const cModuleImage> > images;
+    return images;
+  }
+
+  // The up-to-date image of the module at path, compiling it only if no image matches its source.
+  std::shared_ptr<const cModuleImage> GetImage(const std::string & path, tParseFile parse_file,
+                                               const std::string & engine)
+  {
+    // Images are matched to the source by its contents, as a modification time can stay the same
+    // across an edit (it only counts whole seconds).
+    std::ifstream source(path.c_str(), std::ios::binary);
+    if (!source) ModuleError(path, "unable to open the file.");
+    const std::string contents((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
+    const long long source_size = (long long) contents.size();
+    const long long source_hash = HashContents(contents);
+    auto UpToDate = [&](const cModuleImage & image) {
+      return image.engine == engine && image.source_size == source_size && image.source_hash == source_hash;
+    };
+
+    std::shared_ptr<const cModuleImage> & loaded = LoadedImages()[path];
+    if (loaded && UpToDate(*loaded)) return loaded;
+
+    std::shared_ptr<cModuleImage> image = std::make_shared<cModuleImage>();
+    const std::string image_path = path + ".mod";
+    if (!image->Load(image_path) || !UpToDate(*image)) {
+      cHardware module_hardware;
+      parse_file(module_hardware, path);
+      *image = cModuleImage();
+      image->Build(module_hardware);
+      image->engine = engine;
+      image->source_size = source_size;
+      image->source_hash = source_hash;
+      image->Save(image_path);   // Fine if it can't be saved; it will just be compiled again.
+    }
+
+    // Modules are named after their files, without directories or extension.
+    std::string name = path.substr(path.rfind('/') + 1);
+    name = name.substr(0, name.find('.'));
+    if (!IsLabelName(name)) ModuleError(path, "its name must be usable as a label.");
+    image->name = name;
+
+    loaded = image;
+    return loaded;
+  }
+
+  // Append image to the end of hardware's program, followed by an end to stop anything that
+  // runs off the end of it.
+  void Append(cHardware & hardware, const cModuleImage & image, const std::string & path)
+  {
+    const int base = hardware.GetNumInsts();
+    const int size = (int) image.insts.size();
+    for (std::map<std::string,int>::const_iterator it = image.labels.begin(); it != image.labels.end(); it++) {
+      hardware.AddLabel(image.name + "." + it->first, base + it->second);
+    }
+
+    cArena & arena = hardware.GetArena();
+    for (int i = 0; i < size; i++) {
+      const cModuleImage::cInst & inst = image.insts[i];
+      const cInstInfo * info = FindInstInfo(inst.name);
+      if (info == NULL || info->num_args != (int) inst.args.size()) {
+        ModuleError(path, "unknown instruction '" + inst.name + "' in its image.");
+      }
+
+      cInstArg_Base * args[4] = { NULL, NULL, NULL, NULL };
+      for (int arg_id = 0; arg_id < info->num_args; arg_id++) {
+        const cModuleImage::cArg & arg = inst.args[arg_id];
+        switch (arg.type) {
+        case cModuleImage::ARG_FLOAT:
+          if (arg_id + 1 == info->target) {
+            // Relocate positions within the module; anywhere else ends the program, as it did.
+            const int target = (int) arg.value;
+            const int placed = (target >= 0 && target < size) ? base + target : base + size;
+            args[arg_id] = arena.New<cInstArg_Float>((tValue) placed);
+          }
+          else args[arg_id] = arena.New<cInstArg_Float>(arg.value);
+          break;
+        case cModuleImage::ARG_LABEL:
+          if (image.labels.count(arg.label) > 0) args[arg_id] = arena.New<cInstArg_Label>(image.name + "." + arg.label);
+          else args[arg_id] = arena.New<cInstArg_Label>(arg.label);
+          break;
+        case cModuleImage::ARG_VAR: args[arg_id] = arena.New<cInstArg_Var>(arg.id); break;
+        case cModuleImage::ARG_ARRAY: args[arg_id] = arena.New<cInstArg_Array>(arg.id); break;
+        case cModuleImage::ARG_REG: args[arg_id] = arena.New<cInstArg_Reg>(arg.id); break;
+        default: args[arg_id] = arena.New<cInstArg_IP>(); break;
+        }
+      }
+      hardware.AddInst(info->make(arena, inst.line_num, args));
+    }
+    hardware.AddInst(arena.New<cInst_END>(0));
+  }
+
+  // Numeric targets in the main program past its own end used to stop it; with modules linked
+  // after it they are sent to the end placed there instead, as Append() does for modules.
+  void ClampMainTargets(cHardware & hardware)
+  {
+    const int size = hardware.GetNumInsts();
+    cArena & arena = hardware.GetArena();
+    for (int i = 0; i < size; i++) {
+      cInst_Base * inst = hardware.GetInst(i);
+      const cInstInfo * info = FindInstInfo(inst->GetName());
+      if (info == NULL || info->target == 0) continue;
+
+      cInstArg_Base * args[4] = { inst->GetArg1(), inst->GetArg2(), inst->GetArg3(), inst->GetArg4() };
+      cInstArg_Float * target = dynamic_cast<cInstArg_Float *>(args[info->target - 1]);
+      if (target == NULL) continue;
+      const tInt pos = target->AsInt();
+      if (pos >= 0 && pos < size) continue;
+      args[info->target - 1] = arena.New<cInstArg_Float>((tValue) size);
+      hardware.SetInst(i, info->make(arena, inst->GetLineNum(), args));
+    }
+  }
+}
+
+
+void cModuleImage::Build(cHardware & hardware)
+{
+  for (int i = 0; i < hardware.GetNumInsts(); i++) {
+    cInst_Base * inst = hardware.GetInst(i);
+
+    cInst image_inst;
+    image_inst.name = inst->GetName();
+    image_inst.line_num = inst->GetLineNum();
+    cInstArg_Base * const args[4] = { inst->GetArg1(), inst->GetArg2(), inst->GetArg3(), inst->GetArg4() };
+    for (int arg_id = 0; arg_id < 4 && args[arg_id] != NULL; arg_id++) {
+      cArg arg = { ARG_IP, 0, 0, "" };
+      if (cInstArg_Float * value = dynamic_cast<cInstArg_Float *>(args[arg_id])) {
+        arg.type = ARG_FLOAT;
+        arg.value = value->AsFloat();
+      }
+      else if (cInstArg_Label * label = dynamic_cast<cInstArg_Label *>(args[arg_id])) {
+        arg.type = ARG_LABEL;
+        arg.label = label->GetLabel();
+      }
+      else if (cInstArg_Var * var = dynamic_cast<cInstArg_Var *>(args[arg_id])) {
+        arg.type = ARG_VAR;
+        arg.id = var->GetID();
+      }
+      else if (cInstArg_Array * array = dynamic_cast<cInstArg_Array *>(args[arg_id])) {
+        arg.type = ARG_ARRAY;
+        arg.id = array->AsInt();
+      }
+      else if (cInstArg_Reg * reg = dynamic_cast<cInstArg_Reg *>(args[arg_id])) {
+        arg.type = ARG_REG;
+        arg.id = reg->GetID();
+      }
+      image_inst.args.push_back(arg);
+    }
+    insts.push_back(image_inst);
+  }
+
+  labels = hardware.GetLabelMap();
+  imports = hardware.GetImports();
+}
+
+// Images hold values in their native form, so they are only used by builds with the same type.
+bool cModuleImage::Save(const std::string & filename) const
+{
+  // Write under a temporary name first so that other processes never see a partial image.
+  std::stringstream temp_path;
+  temp_path << filename << ".tmp" << getpid();
+  {
+    std::ofstream file(temp_path.str().c_str(), std::ios::binary);
+    if (!file) return false;
+    file.write(image_magic, 8);
+    WriteString(file, TUBE_VALUE_NAME);
+    WriteString(file, engine);
+    WriteInt(file, source_size);
+    WriteInt(file, source_hash);
+
+    WriteInt(file, imports.size());
+    for (int i = 0; i < (int) imports.size(); i++) WriteString(file, imports[i]);
+    WriteInt(file, labels.size());
+    for (std::map<std::string,int>::const_iterator it = labels.begin(); it != labels.end(); it++) {
+      WriteString(file, it->first);
+      WriteInt(file, it->second);
+    }
+    WriteInt(file, insts.size());
+    for (int i = 0; i < (int) insts.size(); i++) {
+      WriteString(file, insts[i].name);
+      WriteInt(file, insts[i].line_num);
+      WriteInt(file, insts[i].args.size());
+      for (int arg_id = 0; arg_id < (int) insts[i].args.size(); arg_id++) {
+        const cArg & arg = insts[i].args[arg_id];
+        WriteInt(file, arg.type);
+        if (arg.type == ARG_FLOAT) file.write((const char *) &arg.value, sizeof(arg.value));
+        else if (arg.type == ARG_LABEL) WriteString(file, arg.label);
+        else if (arg.type != ARG_IP) WriteInt(file, arg.id);
+      }
+    }
+    if (!file) {
+      remove(temp_path.str().c_str());
+      return false;
+    }
+  }
+  if (rename(temp_path.str().c_str(), filename.c_str()) != 0) {
+    remove(temp_path.str().c_str());
+    return false;
+  }
+  return true;
+}
+
+bool cModuleImage::Load(const std::string & filename)
+{
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  if (!file) return false;
+
+  char magic[8];
+  file.read(magic, 8);
+  if (!file || std::string(magic, 8) != std::string(image_magic, 8)) return false;
+  if (ReadString(file) != TUBE_VALUE_NAME) return false;
+  engine = ReadString(file);
+  source_size = ReadInt(file);
+  source_hash = ReadInt(file);
+
+  const long long num_imports = ReadInt(file);
+  for (long long i = 0; file && i < num_imports; i++) imports.push_back(ReadString(file));
+  const long long num_labels = ReadInt(file);
+  for (long long i = 0; file && i < num_labels; i++) {
+    const std::string label = ReadString(file);
+    labels[label] = (int) ReadInt(file);
+  }
+  const long long num_insts = ReadInt(file);
+  for (long long i = 0; file && i < num_insts; i++) {
+    cInst inst;
+    inst.name = ReadString(file);
+    inst.line_num = (int) ReadInt(file);
+    const long long num_args = ReadInt(file);
+    if (num_args < 0 || num_args > 4) return false;
+    for (long long arg_id = 0; file && arg_id < num_args; arg_id++) {
+      cArg arg = { (int) ReadInt(file), 0, 0, "" };
+      if (arg.type == ARG_FLOAT) file.read((char *) &arg.value, sizeof(arg.value));
+      else if (arg.type == ARG_LABEL) arg.label = ReadString(file);
+      else if (arg.type != ARG_IP) arg.id = (int) ReadInt(file);
+      inst.args.push_back(arg);
+    }
+    insts.push_back(inst);
+  }
+  return (bool) file;
+}
+
+
+std::string ResolveModulePath(const std::string & from_file, const std::string & path)
+{
+  std::string full_path = path;
+  const size_t dir_end = from_file.rfind('/');
+  if (path.size() > 0 && path[0] != '/' && dir_end != std::string::npos) {
+    full_path = from_file.substr(0, dir_end + 1) + path;
+  }
+
+  // The same module imported by different routes should only be linked once.
+  char * real_path = realpath(full_path.c_str(), NULL);
+  if (real_path == NULL) return full_path;
+  full_path = real_path;
+  free(real_path);
+  return full_path;
+}
+
+void LinkModules(cHardware & hardware, tParseFile parse_file, const std::string & engine)
+{
+  std::vector<std::string> pending = hardware.GetImports();
+  if (pending.size() == 0) return;
+
+  ClampMainTargets(hardware);
+  cArena & arena = hardware.GetArena();
+  hardware.AddInst(arena.New<cInst_END>(0));   // The program itself stops where its source did.
+
+  std::set<std::string> linked;
+  std::map<std::string,std::string> names;   // Path of the module linked under each name.
+  for (int i = 0; i < (int) pending.size(); i++) {
+    const std::string path = pending[i];
+    if (linked.count(path) > 0) continue;
+    linked.insert(path);
+
+    std::shared_ptr<const cModuleImage> image = GetImage(path, parse_file, engine);
+    if (names.count(image->name) > 0) {
+      ModuleError(path, "the name '" + image->name + "' is already used by " + names[image->name] + ".");
+    }
+    names[image->name] = path;
+    Append(hardware, *image, path);
+    pending.insert(pending.end(), image->imports.begin(), image->imports.end());
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef MODULE_H
+#define MODULE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "hardware.h"
+
+// Programs share code through modules, each a source file of its own:
+//
+//   import "lib/sort.tube"
+//
+// A module is compiled separately into a cModuleImage, kept in memory and saved beside its
+// source (as lib/sort.tube.mod), so that it is only parsed again once the source changes.  After
+// a program is parsed, LinkModules() appends the modules it imports (and those they import, each
+// once) after the end of the program.  Each module's labels are placed in the program's label
+// map under the module's name, so "loop" in lib/sort.tube is "sort.loop" everywhere else, while
+// plain "loop" still refers to it within the module.  Jumps to numbered positions are relocated.
+
+// Parses the file filename into hardware, as the front end would.
+typedef void (*tParseFile)(cHardware & hardware, const std::string & filename);
+
+// A compiled module, in a form that doesn't depend on where it is placed in a program.
+class cModuleImage {
+public:
+  enum ArgType { ARG_FLOAT=0, ARG_LABEL, ARG_VAR, ARG_ARRAY, ARG_REG, ARG_IP };
+
+  struct cArg {
+    int type;
+    int id;              // Register, scalar or array.
+    tValue value;
+    std::string label;
+  };
+
+  struct cInst {
+    std::string name;
+    int line_num;
+    std::vector<cArg> args;
+  };
+
+  std::string name;                         // Namespace for its labels.
+  std::vector<cInst> insts;
+  std::map<std::string,int> labels;         // Positions counted from the start of the module.
+  std::vector<std::string> imports;         // Paths of the modules it imports in turn.
+  std::string engine;                       // Front end that parsed it.
+  long long source_size;                    // Size and a hash of the contents of the source
+  long long source_hash;                    // file it was built from.
+
+  cModuleImage() : source_size(-1), source_hash(-1) { ; }
+  ~cModuleImage() { ; }
+
+  void Build(cHardware & hardware);   // From a freshly parsed module.
+  bool Save(const std::string & filename) const;
+  bool Load(const std::string & filename);
+};
+
+// Path of a module imported as path by the source file from_file (empty if not from a file).
+std::string ResolveModulePath(const std::string & from_file, const std::string & path);
+
+// Link everything hardware's program imports into it, compiling modules with parse_file where
+// there isn't an up-to-date image.  A module that can't be read or linked ends the process.
+void LinkModules(cHardware & hardware, tParseFile parse_file, const std::string & engine);
+
+#endif
@@ -0,0 +1,289 @@
+#include "scheduler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "estimate.h"
+
+namespace {
+  // One worker's share of the tasks.  The owner works from the back; thieves take from the front.
+  struct cWorkQueue {
+    std::mutex lock;
+    std::deque<int> tasks;
+  };
+}
+
+int cScheduler::Add(cHardware * hardware, const std::string & name, int priority)
+{
+  if (priority < 1) priority = 1;
+
+  // New tasks start level with the least-advanced runnable task, so they don't take over the thread.
+  long long pass = 0;
+  bool found = false;
+  for (int i = 0; i < (int) tasks.size(); i++) {
+    if (!IsRunnable(tasks[i]) || (found && tasks[i].pass >= pass)) continue;
+    pass = tasks[i].pass;
+    found = true;
+  }
+
+  const cCostEstimate estimate(*hardware);
+  cTask task = { hardware, name, priority, false, pass, 0, 0,
+                 estimate.GetMinCycles(), estimate.GetMaxCycles() };
+  tasks.push_back(task);
+  return (int) tasks.size() - 1;
+}
+
+void cScheduler::Resume(int id)
+{
+  cTask & task = tasks[id];
+  if (task.suspended == false) return;
+  task.suspended = false;
+
+  // A task does not bank the time it spent suspended.
+  for (int i = 0; i < (int) tasks.size(); i++) {
+    if (i != id && IsRunnable(tasks[i]) && tasks[i].pass > task.pass) task.pass = tasks[i].pass;
+  }
+}
+
+// Is a expected to run longer than b?  No upper bound counts as longest.
+bool cScheduler::IsLonger(const cTask & a, const cTask & b)
+{
+  const long long a_max = (a.max_cycles == cCostEstimate::UNBOUNDED) ? LLONG_MAX : a.max_cycles;
+  const long long b_max = (b.max_cycles == cCostEstimate::UNBOUNDED) ? LLONG_MAX : b.max_cycles;
+  if (a_max != b_max) return a_max > b_max;
+  return a.min_cycles > b.min_cycles;
+}
+
+int cScheduler::PickTask()
+{
+  const int num_tasks = (int) tasks.size();
+
+  if (policy == SCHEDULE_ROUND_ROBIN) {
+    for (int offset = 0; offset < num_tasks; offset++) {
+      const int id = (next_task + offset) % num_tasks;
+      if (IsRunnable(tasks[id])) {
+        next_task = (id + 1) % num_tasks;
+        return id;
+      }
+    }
+    return -1;
+  }
+
+  // Priority: lowest pass first, ties going to the earliest task.
+  int best = -1;
+  for (int id = 0; id < num_tasks; id++) {
+    if (!IsRunnable(tasks[id])) continue;
+    if (best == -1 || tasks[id].pass < tasks[best].pass) best = id;
+  }
+  return best;
+}
+
+bool cScheduler::RunQuantum()
+{
+  const int id = PickTask();
+  if (id == -1) return false;
+
+  cTask & task = tasks[id];
+  task.steps += task.hardware->RunSteps(quantum);
+  task.pass += STRIDE_BASE / task.priority;
+  task.quanta++;
+  total_quanta++;
+
+  return true;
+}
+
+void cScheduler::Run()
+{
+  while (RunQuantum());
+}
+
+void cScheduler::RunParallel(int num_threads)
+{
+  if (num_threads <= 1) {
+    Run();
+    return;
+  }
+
+  std::vector<cWorkQueue> queues(num_threads);
+  std::atomic<int> tasks_left(0);
+  std::atomic<int> tasks_queued(0);   // Tasks sitting in a deque, waiting for a worker.
+  std::atomic<int> quanta(0);
+  std::atomic<int> steals(0);
+
+  // Workers with nothing to run or steal sleep until a task is requeued or the last one ends.
+  std::mutex idle_lock;
+  std::condition_variable idle_wake;
+  std::atomic<int> idle_workers(0);
+  auto wake_idle = [&idle_lock, &idle_wake, &idle_workers](bool all) {
+    if (idle_workers == 0) return;
+    std::lock_guard<std::mutex> guard(idle_lock);
+    if (all) idle_wake.notify_all();
+    else idle_wake.notify_one();
+  };
+
+  // Deal the tasks out evenly to start, longest first and each ahead of the rest at the back of
+  // its deque; stealing evens out whatever this gets wrong.
+  std::vector<int> order;
+  for (int id = 0; id < (int) tasks.size(); id++) {
+    if (IsRunnable(tasks[id])) order.push_back(id);
+  }
+  std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return IsLonger(tasks[a], tasks[b]); });
+  for (int i = 0; i < (int) order.size(); i++) {
+    queues[i % num_threads].tasks.push_front(order[i]);
+    tasks_left++;
+    tasks_queued++;
+  }
+
+  auto worker = [&](int worker_id) {
+    cWorkQueue & own = queues[worker_id];
+    while (tasks_left > 0) {
+      int id = -1;
+      {
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (own.tasks.size() > 0) {
+          id = own.tasks.back();
+          own.tasks.pop_back();
+        }
+      }
+      for (int offset = 1; id == -1 && offset < num_threads; offset++) {
+        cWorkQueue & victim = queues[(worker_id + offset) % num_threads];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (victim.tasks.size() > 0) {
+          id = victim.tasks.front();
+          victim.tasks.pop_front();
+          steals++;
+        }
+      }
+      if (id == -1) {               // Everything left is being run by other workers.
+        std::unique_lock<std::mutex> lock(idle_lock);
+        idle_workers++;
+        idle_wake.wait(lock, [&tasks_queued, &tasks_left]() { return tasks_queued > 0 || tasks_left == 0; });
+        idle_workers--;
+        continue;
+      }
+      tasks_queued--;
+
+      // Only the worker holding a task touches it, so its counters need no locking.
+      cTask & task = tasks[id];
+      task.steps += task.hardware->RunSteps(quantum);
+      task.quanta++;
+      quanta++;
+
+      if (IsRunnable(task)) {
+        {
+          std::lock_guard<std::mutex> guard(own.lock);
+          own.tasks.push_back(id);
+        }
+        tasks_queued++;
+        wake_idle(false);
+      }
+      else if (--tasks_left == 0) wake_idle(true);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; i++) threads.push_back(std::thread(worker, i));
+  for (int i = 0; i < num_threads; i++) threads[i].join();
+
+  total_quanta += quanta;
+  total_steals += steals;
+}
+
+// The first non-zero exit code among the tasks, if any.
+int cScheduler::GetExitCode() const
+{
+  for (int i = 0; i < (int) tasks.size(); i++) {
+    const int exit_code = tasks[i].hardware->GetExitCode();
+    if (exit_code != 0) return exit_code;
+  }
+  return 0;
+}
+
+void cScheduler::PrintStats(std::ostream & out) const
+{
+  out << "Scheduler: " << tasks.size() << " programs, " << total_quanta << " quanta of "
+      << quantum << " instructions";
+  if (total_steals > 0) out << ", " << total_steals << " moved between threads";
+  out << std::endl;
+  for (int i = 0; i < (int) tasks.size(); i++) {
+    const cTask & task = tasks[i];
+    const double share = total_quanta ? (100.0 * task.quanta / total_quanta) : 0.0;
+    out << "  " << task.name
+        << "  priority=" << task.priority
+        << "  quanta=" << task.quanta
+        << " (" << std::fixed << std::setprecision(1) << share << "%)"
+        << std::defaultfloat
+        << "  steps=" << task.steps
+        << "  cycles=" << task.hardware->GetExeCount()
+        << "  exit=" << task.hardware->GetExitCode()
+        << (task.suspended ? "  (suspended)" : "")
+        << std::endl;
+  }
+}
+
+
+int RunScheduled(cHardware & base_hardware, tParseFile parse_file, cResultCache * cache,
+                 const std::string & engine, const std::vector<std::string> & files,
+                 const std::vector<int> & priorities, int quantum, int policy, int num_threads)
+{
+  // Tracing and checkpoints are per run, so they are refused rather than silently ignored.
+  const char * option = base_hardware.IsVerbose() ? "-v" : base_hardware.HasCheckpoint() ? "-k" :
+                        base_hardware.HasResumeFile() ? "-r" : NULL;
+  if (option != NULL) {
+    std::cerr << "Error: " << option << " cannot be used together with -q or -j." << std::endl;
+    exit(1);
+  }
+
+  const int num_files = (int) files.size();
+  std::vector<cRunResult> results(num_files);
+  std::vector<unsigned long long> keys(num_files, 0);
+  std::vector<int> task_ids(num_files, -1);
+  std::vector<size_t> load_sizes(num_files, 0);   // Output from loading each program.
+
+  cScheduler scheduler(quantum, policy);
+  for (int i = 0; i < num_files; i++) {
+    cHardware * hardware = base_hardware.Fork();
+    parse_file(*hardware, files[i]);
+    hardware->SetPrintToConsole(false);
+    load_sizes[i] = hardware->GetMessages().size();
+
+    // Programs with a stored result don't need to be run again.
+    const bool use_cache = (cache != NULL && hardware->IsRepeatable());
+    if (use_cache) keys[i] = cache->GetKey(*hardware, engine);
+    if (use_cache && cache->Lookup(keys[i], results[i])) {
+      results[i].output = hardware->GetMessages() + results[i].output;
+      delete hardware;
+      continue;
+    }
+    task_ids[i] = scheduler.Add(hardware, files[i], priorities[i]);
+  }
+
+  scheduler.RunParallel(num_threads);
+
+  int exit_code = 0;
+  for (int i = 0; i < num_files; i++) {
+    if (task_ids[i] >= 0) {
+      cHardware & hardware = scheduler.GetHardware(task_ids[i]);
+      hardware.PrintCycles();
+      results[i].output = hardware.GetMessages();
+      results[i].exe_count = hardware.GetExeCount();
+      results[i].halt_type = hardware.GetHaltType();
+      if (cache != NULL && hardware.IsRepeatable() && results[i].halt_type != HALT_WALL_TIME) {
+        cRunResult stored(results[i]);
+        stored.output = stored.output.substr(load_sizes[i]);
+        cache->Store(keys[i], stored);
+      }
+    }
+    std::cout << "=== " << files[i] << " ===" << std::endl << results[i].output;
+    if (exit_code == 0) exit_code = results[i].GetExitCode();
+  }
+  scheduler.PrintStats(std::cout);
+  return exit_code;
+}
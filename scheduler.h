@@ -0,0 +1,93 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "cache.h"
+#include "hardware.h"
+#include "module.h"
+
+enum SchedulePolicy { SCHEDULE_ROUND_ROBIN=0, SCHEDULE_PRIORITY };
+
+// Shares a single thread between many cHardware instances by running each for a quantum of
+// instructions at a time.  Round-robin gives every runnable instance a turn in order; priority
+// scheduling gives each instance a share of quanta in proportion to its priority (stride
+// scheduling), so even the lowest priority instances keep making progress.
+//
+// RunParallel() instead spreads the instances over a pool of threads for throughput.  Each
+// worker keeps a deque of instances and runs the one at its back a quantum at a time; a worker
+// with nothing left steals from the front of another's deque, so an instance can migrate
+// between threads at any quantum boundary (and sleeps when there is nothing to steal).  Instances are dealt out longest first, going by a
+// static estimate of their cycles, so that the longest runs don't start last.  Priorities are
+// not used there.  Runtime errors halt only the instance that hits them (HALT_ERROR), so no
+// worker ever ends the process while others are running.  Instances must not share a program
+// (see cHardware::Fork()).
+class cScheduler {
+private:
+  static const long long STRIDE_BASE = 1 << 20;
+
+  struct cTask {
+    cHardware * hardware;
+    std::string name;
+    int priority;
+    bool suspended;
+    long long pass;       // Virtual time; the runnable task with the lowest pass goes next.
+    int quanta;           // Number of quanta this task has been given.
+    long long steps;      // Instructions executed across all of its quanta.
+    long long min_cycles; // Static estimate of the whole run (see estimate.h).
+    long long max_cycles;
+  };
+
+  std::vector<cTask> tasks;
+  int quantum;
+  int policy;
+  int next_task;          // Where the round-robin search starts.
+  int total_quanta;
+  int total_steals;       // Instances moved between workers by RunParallel().
+
+  bool IsRunnable(const cTask & task) const {
+    return !task.suspended && task.hardware->GetHaltType() == HALT_NONE;
+  }
+  int PickTask();
+  static bool IsLonger(const cTask & a, const cTask & b);
+
+public:
+  cScheduler(int _quantum=1000, int _policy=SCHEDULE_ROUND_ROBIN)
+    : quantum(_quantum), policy(_policy), next_task(0), total_quanta(0), total_steals(0) { ; }
+  ~cScheduler() {
+    for (int i = 0; i < (int) tasks.size(); i++) delete tasks[i].hardware;
+  }
+
+  // The scheduler takes ownership of hardware; returns the ID used to refer to it.
+  int Add(cHardware * hardware, const std::string & name, int priority=1);
+
+  int GetNumTasks() const { return (int) tasks.size(); }
+  cHardware & GetHardware(int id) { return *(tasks[id].hardware); }
+  const std::string & GetName(int id) const { return tasks[id].name; }
+  int GetQuanta(int id) const { return tasks[id].quanta; }
+  long long GetSteps(int id) const { return tasks[id].steps; }
+  int GetTotalQuanta() const { return total_quanta; }
+  int GetTotalSteals() const { return total_steals; }
+
+  void Suspend(int id) { tasks[id].suspended = true; }
+  void Resume(int id);
+  bool IsSuspended(int id) const { return tasks[id].suspended; }
+
+  bool RunQuantum();   // Give one quantum to the next task; false if nothing is runnable.
+  void Run();          // Run until every task has halted or been suspended.
+  void RunParallel(int num_threads);  // As Run(), spread across threads; don't Suspend() meanwhile.
+
+  int GetExitCode() const;
+  void PrintStats(std::ostream & out) const;
+};
+
+// Load each of files into its own fork of base_hardware with parse_file, run them all together
+// (across num_threads threads), and print each one's output followed by the scheduler's statistics;
+// returns the first non-zero exit code, if any.  Programs with a result in cache aren't run again.
+int RunScheduled(cHardware & base_hardware, tParseFile parse_file, cResultCache * cache,
+                 const std::string & engine, const std::vector<std::string> & files,
+                 const std::vector<int> & priorities, int quantum, int policy, int num_threads);
+
+#endif
@@ -0,0 +1,140 @@
+#include "server.h"
+
+#include <cerrno>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+  // Apply one "name=value" run option; returns false if it isn't recognized.
+  bool ApplyOption(cHardware & hardware, const std::string & option)
+  {
+    const size_t split = option.find('=');
+    if (split == std::string::npos) return false;
+    const std::string name = option.substr(0, split);
+    std::stringstream value(option.substr(split + 1));
+
+    if (name == "timeout") { int v; value >> v; hardware.SetTimeout(v); }
+    else if (name == "wall") { double v; value >> v; hardware.SetWallTimeLimit(v); }
+    else if (name == "calls") { int v; value >> v; hardware.SetCallLimit(v); }
+    else if (name == "output") { long long v; value >> v; hardware.SetOutputLimit(v); }
+    else if (name == "pages") { int v; value >> v; hardware.SetMemPageLimit(v); }
+    else if (name == "arrays") { int v; value >> v; hardware.SetArrayLimit(v); }
+    else if (name == "stack") { int v; value >> v; hardware.SetStackLimit(v); }
+    else if (name == "loop") { int v; value >> v; hardware.SetLoopCheck(v); }
+    else if (name == "seed") { unsigned int v; value >> v; hardware.SetSeed(v); }
+    else return false;
+
+    return !value.fail();
+  }
+
+  std::string ReadAll(int fd)
+  {
+    std::string result;
+    char buffer[4096];
+    ssize_t count;
+    while ((count = read(fd, buffer, sizeof(buffer))) != 0) {
+      if (count > 0) result.append(buffer, count);
+      else if (errno != EINTR) break;
+    }
+    return result;
+  }
+
+  void Respond(std::ostream & out, int exit_code, const std::string & stats, const std::string & output)
+  {
+    out << "done " << exit_code << " " << (stats.size() ? stats : "-1 -1") << " " << output.size() << '\n'
+        << output;
+    out.flush();
+  }
+}
+
+int RunServer(cHardware & base_hardware, tLoadSource load_source, cResultCache * cache,
+              const std::string & engine, std::istream & in, std::ostream & out)
+{
+  std::string header;
+  while (std::getline(in, header)) {
+    std::stringstream header_ss(header);
+    std::string command;
+    header_ss >> command;
+    if (command == "") continue;
+    if (command == "quit") break;
+
+    long long source_size = -1;
+    header_ss >> source_size;
+    if (command != "run" || source_size < 0) {
+      out << "error Expected 'run <source bytes> [option=value ...]' or 'quit'." << '\n';
+      out.flush();
+      continue;
+    }
+    std::vector<std::string> options;
+    std::string option;
+    while (header_ss >> option) options.push_back(option);
+
+    std::string source(source_size, '\0');
+    if (source_size > 0 && !in.read(&source[0], source_size)) break;
+
+    int output_pipe[2], stats_pipe[2];
+    if (pipe(output_pipe) != 0 || pipe(stats_pipe) != 0) {
+      out << "error Unable to create pipes for a run." << '\n';
+      out.flush();
+      return 1;
+    }
+    out.flush();
+    std::cerr.flush();
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+      out << "error Unable to start a run." << '\n';
+      out.flush();
+      return 1;
+    }
+
+    if (pid == 0) {
+      // Child: everything the run prints (including fatal errors) goes back through the pipe.  It
+      // also lets go of the request stream, so flushing it on exit can't move the server's place.
+      const int null_fd = open("/dev/null", O_RDONLY);
+      dup2(null_fd, STDIN_FILENO);
+      close(null_fd);
+      close(output_pipe[0]);
+      close(stats_pipe[0]);
+      dup2(output_pipe[1], STDOUT_FILENO);
+      dup2(output_pipe[1], STDERR_FILENO);
+      close(output_pipe[1]);
+
+      for (int i = 0; i < (int) options.size(); i++) {
+        if (!ApplyOption(base_hardware, options[i])) {
+          std::cout << "ERROR: Unknown run option '" << options[i] << "'." << std::endl;
+          exit(1);
+        }
+      }
+      load_source(base_hardware, source);
+      const cRunResult result = RunWithCache(base_hardware, cache, engine);
+      std::cout.flush();
+
+      std::stringstream stats;
+      stats << result.exe_count << " " << result.halt_type;
+      const std::string stats_str = stats.str();
+      const ssize_t written = write(stats_pipe[1], stats_str.c_str(), stats_str.size());
+      (void) written;
+      exit(result.GetExitCode());
+    }
+
+    // Server: collect the output, then how the run ended.
+    close(output_pipe[1]);
+    close(stats_pipe[1]);
+    const std::string output = ReadAll(output_pipe[0]);
+    const std::string stats = ReadAll(stats_pipe[0]);
+    close(output_pipe[0]);
+    close(stats_pipe[0]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    const int exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    Respond(out, exit_code, stats, output);
+  }
+
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <iostream>
+#include <string>
+
+#include "cache.h"
+#include "hardware.h"
+
+// Parses source into hardware, as the front end would for a file.
+typedef void (*tLoadSource)(cHardware & hardware, const std::string & source);
+
+// Serves runs over a simple framed protocol, so one warm process can handle many programs.
+// Each request is a header line followed by the program source:
+//
+//   run <source bytes> [option=value ...]
+//   <source>
+//
+// Options are timeout, wall, calls, output, pages, arrays, stack, loop and seed, matching the
+// command-line limits.  Each response is a header line followed by everything the run printed:
+//
+//   done <exit code> <cycles> <halt type> <output bytes>
+//   <output>
+//
+// Every run starts from a copy of base_hardware (with its command-line settings) in a child
+// process forked from the server, so even errors that end the process only end that one run;
+// cycles and halt type are -1 if the run never finished.  A "quit" line ends the server.
+// Results are looked up in (and added to) cache, if there is one.
+int RunServer(cHardware & base_hardware, tLoadSource load_source, cResultCache * cache,
+              const std::string & engine, std::istream & in=std::cin, std::ostream & out=std::cout);
+
+#endif
@@ -0,0 +1,71 @@
+#include "source.h"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool cSourceMap::Open(const std::string & filename)
+{
+  Close();
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+    close(fd);
+    return false;
+  }
+
+  // Reserve zeroed memory for the file and the nulls after it, then map the file over the start;
+  // the rest of its last page reads as zeros too.
+  const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+  const size_t file_size = (size_t) info.st_size;
+  const size_t total_size = (file_size + 2 + page_size - 1) / page_size * page_size;
+  void * region = mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  if (file_size > 0 &&
+      mmap(region, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(region, total_size);
+    close(fd);
+    return false;
+  }
+  close(fd);
+  madvise(region, total_size, MADV_SEQUENTIAL);
+
+  base = static_cast<char *>(region);
+  size = file_size;
+  map_size = total_size;
+  return true;
+}
+
+void cSourceMap::Close()
+{
+  if (base != NULL) munmap(base, map_size);
+  base = NULL;
+  size = map_size = 0;
+}
+
+long long cSourceMap::CountLines() const
+{
+  long long num_lines = 0;
+  const char * pos = base;
+  const char * end = base + size;
+  while (pos < end && (pos = static_cast<const char *>(memchr(pos, '\n', end - pos))) != NULL) {
+    num_lines++;
+    pos++;
+  }
+  return num_lines;
+}
+
+
+void PrintLoadStats(std::ostream & out, long long num_lines, double seconds)
+{
+  out << "Loaded " << num_lines << " lines in " << seconds << " seconds";
+  if (seconds > 0.0) out << " (" << (long long) (num_lines / seconds) << " lines/s)";
+  out << '\n';
+}
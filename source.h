@@ -0,0 +1,36 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+
+// A source file mapped straight into memory, so that the lexer can scan it in place (with
+// yy_scan_buffer()) rather than copying it through a FILE a few kilobytes at a time.  The
+// mapping is private and writable, as the lexer marks the ends of tokens in the buffer, and is
+// followed by the two null bytes that yy_scan_buffer() expects.
+class cSourceMap {
+private:
+  char * base;
+  size_t size;       // Bytes in the file.
+  size_t map_size;   // Bytes mapped, including the nulls after the file.
+
+public:
+  cSourceMap() : base(NULL), size(0), map_size(0) { ; }
+  cSourceMap(const cSourceMap &) = delete;
+  cSourceMap & operator=(const cSourceMap &) = delete;
+  ~cSourceMap() { Close(); }
+
+  bool Open(const std::string & filename);   // False if it can't be mapped (such as a pipe).
+  void Close();
+
+  char * GetBuffer() { return base; }
+  size_t GetSize() const { return size; }
+  size_t GetScanSize() const { return size + 2; }   // Including the nulls, for yy_scan_buffer().
+  long long CountLines() const;
+};
+
+// Report how quickly a program of num_lines lines was loaded (-stats).
+void PrintLoadStats(std::ostream & out, long long num_lines, double seconds);
+
+#endif
@@ -4,6 +4,9 @@ VM_UI_base * VMUI;
 extern cHardware * main_hardware;
 
 bool ParseString(const std::string &);
+bool ParseLines(const std::string &, int);
+
+std::vector<std::string> loaded_lines;   // Source of the program in main_hardware, by line.
 
 int main()
 {
@@ -17,17 +20,112 @@ int main()
 }
 
 
+// Split code into its lines, without their newlines.
+std::vector<std::string> SplitLines(const std::string & code)
+{
+  std::vector<std::string> lines;
+  size_t start = 0;
+  while (true) {
+    const size_t end = code.find('\n', start);
+    if (end == std::string::npos) break;
+    lines.push_back(code.substr(start, end - start));
+    start = end + 1;
+  }
+  lines.push_back(code.substr(start));
+  return lines;
+}
+
+// Index of the first instruction on a line after line_id (instructions are in line order).
+int FirstInstAfter(int line_id)
+{
+  int low = 0, high = main_hardware->GetNumInsts();
+  while (low < high) {
+    const int mid = (low + high) / 2;
+    if (main_hardware->GetInst(mid)->GetLineNum() <= line_id) low = mid + 1;
+    else high = mid;
+  }
+  return low;
+}
+
+// Parse only the lines that differ from the loaded program, patching it in place.  Returns false
+// if the code needs to be loaded from scratch instead.
+bool ReloadChanged(const std::vector<std::string> & lines)
+{
+  // A label defined twice hides the first definition, which an edit may bring back.
+  if (main_hardware == NULL || main_hardware->GetImports().size() > 0 || main_hardware->HasReusedLabels()) {
+    return false;
+  }
+
+  const int old_size = (int) loaded_lines.size();
+  const int new_size = (int) lines.size();
+  const int min_size = (old_size < new_size) ? old_size : new_size;
+  int same_start = 0, same_end = 0;
+  // Only the last line lacks a newline, so if it moves it needs parsing again.
+  const int max_start = (old_size == new_size) ? min_size : min_size - 1;
+  while (same_start < max_start && loaded_lines[same_start] == lines[same_start]) same_start++;
+  while (same_end < min_size - same_start &&
+         loaded_lines[old_size - 1 - same_end] == lines[new_size - 1 - same_end]) same_end++;
+  if (same_start == old_size && same_start == new_size) return true;
+
+  // Widen the edit to run from just after the instruction before it through the line of the
+  // instruction after it, so that it covers every label that could point into it.
+  const int first = FirstInstAfter(same_start);
+  const int next = FirstInstAfter(old_size - same_end);
+  const int first_line = (first > 0) ? main_hardware->GetInst(first - 1)->GetLineNum() + 1 : 1;
+  const int last_line = ((next < main_hardware->GetNumInsts()) ? main_hardware->GetInst(next)->GetLineNum() : old_size)
+    + new_size - old_size;
+
+  std::string changed;
+  for (int line_id = first_line; line_id <= last_line; line_id++) {
+    changed += lines[line_id - 1];
+    if (line_id < new_size) changed += '\n';
+  }
+
+  main_hardware->BeginReplace(first, next - first);
+  ParseLines(changed, first_line);
+  main_hardware->EndReplace(new_size - old_size);
+  // Newly imported modules need linking.
+  return main_hardware->GetImports().size() == 0 && !main_hardware->HasReusedLabels();
+}
+
 extern "C" int LoadCode(std::string in_code)
 {
+  // If only part of the program changed, keep the hardware and re-parse just that part.
+  std::vector<std::string> lines = SplitLines(in_code);
+  if (ReloadChanged(lines)) {
+    loaded_lines.swap(lines);
+    VMUI->CodeEdited();
+    return 0;
+  }
+
   // Initialize hardware object and UI.
   if (main_hardware != NULL) delete main_hardware;  // Remove existing hardware, if any
   main_hardware = new cHardware();                  // Build new hardware.
+  main_hardware->SetUndoLimit(100000);              // Allow stepping back through recent history.
 
   // Parse the input code (which will automatically load it into the main hardware.
   ParseString(in_code.c_str());
+  loaded_lines.swap(lines);
 
   // Setup the UI with the newly loaded hardware.
   VMUI->SetupHardware(main_hardware);
 
   return 0;
 }
+
+// Scroll notifications from the page, so that only visible rows need to be drawn.
+extern "C" void CodeScrolled(int scroll_top)
+{
+  if (main_hardware != NULL) VMUI->CodeScrolled(scroll_top);
+}
+
+extern "C" void MemScrolled(int scroll_top)
+{
+  if (main_hardware != NULL) VMUI->MemScrolled(scroll_top);
+}
+
+// Breakpoint clicks from the code table; condition is empty for an unconditional breakpoint.
+extern "C" void ToggleBreakpoint(int inst_id, const char * condition)
+{
+  if (main_hardware != NULL) VMUI->ToggleBreakpoint(inst_id, condition);
+}
@@ -18,19 +18,46 @@ extern "C" int LoadCode(std::string);
 // Some general constants.
 static const std::string inst_bg = "#f0f0f0";  // What color should general cells be?
 static const std::string IP_bg = "#d0f0d0";    // What color should active cells be?
+static const std::string break_bg = "#f0d0d0"; // What color should cells with breakpoints be?
 static const std::string title_bg = "#CCCCFF"; // What color should the var title background be?
 
 static const int var_table_width = 500;
+
+// Play speeds, in instructions per second (0 = as fast as possible).
+static const int play_speeds[] = { 1, 4, 16, 64, 256, 1024, 0 };
+static const int num_play_speeds = 7;
+static const double frame_budget_ms = 12.0;  // Time per frame to spend executing instructions.
+static const int frame_delay_ms = 16;        // Time between frames when playing at a set speed.
+
 static const int var_table_col_count = 4;
+
+// Only a window of rows around the visible part of the code and memory views is put in the page,
+// so drawing cost does not depend on program or memory size.  Rows must have a fixed height for
+// the spacers above and below the window to keep the scrollbar accurate.
+static const int row_height = 20;         // Height of one code or memory row, in pixels.
+static const int code_view_height = 500;  // Height of the scrolling code view, in pixels.
+static const int code_visible_rows = code_view_height / row_height;
+static const int view_margin_rows = 10;   // Extra rows drawn above and below the visible ones.
+static const int mem_row_size = 10;       // Memory positions shown per row.
+static const int mem_view_height = 200;   // Height of the scrolling memory view, in pixels.
+static const int mem_visible_rows = mem_view_height / row_height;
+
+std::string AsPixels(int pixels) {
+  std::stringstream ss;
+  ss << pixels << "px";
+  return ss.str();
+}
 static UI::Document doc("emp_base");
 
 void DoLoadCode(const std::string & in_code) {
   emp::Alert(in_code);
   LoadCode(in_code);
   doc.Button("but_restart").Disabled(false);
+  doc.Button("but_back").Disabled(false);
   doc.Button("but_step").Disabled(false);
   doc.Button("but_play").Disabled(false);
   doc.Button("but_end").Disabled(false);
+  doc.Button("but_speed").Disabled(false);
 }
 
 class VM_UI_base {
@@ -38,9 +65,91 @@ protected:
   cHardware * hardware;
 
   bool is_paused;
+  std::vector<int> inst_rows;   // Which line of the code view holds each instruction?
+  std::vector<int> code_lines;  // Instruction on each line of the code view (-1-N for label N).
+  std::vector<std::string> line_labels;
+  int code_view_top;            // First line currently scrolled into view.
+  int code_top;                 // First line drawn into the code table.
+
+  int play_speed_id;            // Current entry in play_speeds.
+  bool play_pending;            // Is a frame already scheduled?
+  bool run_to_end;              // Should we play as fast as possible until the program halts?
+  double play_last_time;        // When did the previous frame run (in ms)?
+  double play_owed;             // Instructions due at the current speed but not yet executed.
+  int play_batch;               // Instructions to execute between checks of the clock.
+
+  std::string SpeedLabel() const {
+    std::stringstream ss;
+    ss << "Speed: ";
+    if (play_speeds[play_speed_id] == 0) ss << "max";
+    else ss << play_speeds[play_speed_id] << "/s";
+    return ss.str();
+  }
+
+  // Run instructions in batches until time_budget is used up; each batch is resized so that
+  // the clock is checked often enough to stay in budget but not so often that it costs much.
+  int RunForTime(double time_budget, int max_steps) {
+    const double start_time = emscripten_get_now();
+    int steps = 0;
+    while (max_steps > 0 && hardware->GetNextIP() < hardware->GetNumInsts()) {
+      if (steps > 0 && hardware->AtBreakpoint()) break;
+      const double batch_start = emscripten_get_now();
+      if (batch_start - start_time >= time_budget) break;
+      const int batch = (play_batch < max_steps) ? play_batch : max_steps;
+      const int batch_steps = hardware->RunSteps(batch);
+      steps += batch_steps;
+      max_steps -= batch_steps;
+      const double batch_time = emscripten_get_now() - batch_start;
+      if (batch_time < time_budget / 8 && play_batch < (1 << 20)) play_batch *= 2;
+      else if (batch_time > time_budget / 2 && play_batch > 1) play_batch /= 2;
+    }
+    return steps;
+  }
+
+  // Background for the code row of an instruction.
+  std::string RowBackground(int inst_id) const {
+    if (inst_id == hardware->GetNextIP()) return IP_bg;
+    if (hardware->HasBreakpoint(inst_id)) return break_bg;
+    return "white";
+  }
+
+  // Scalar or register named in a breakpoint condition (-1 if there isn't one by that name).
+  virtual int FindVarID(const std::string & name) const {
+    if (name.size() < 2 || name[0] != 's') return -1;
+    return (name.find_first_not_of("0123456789", 1) == std::string::npos) ? atoi(name.c_str() + 1) : -1;
+  }
+
+  // Build a test from a condition such as "s3 > 10"; returns false if it can't be understood.
+  bool ParseCondition(const std::string & text, tBreakCondition & test) const {
+    const size_t op_start = text.find_first_of("<>=!");
+    if (op_start == std::string::npos) return false;
+    size_t op_end = text.find_first_not_of("<>=!", op_start);
+    if (op_end == std::string::npos) op_end = text.size();
+
+    std::stringstream name_ss(text.substr(0, op_start));
+    std::stringstream value_ss(text.substr(op_end));
+    std::string name, extra;
+    tValue value = 0.0;
+    name_ss >> name;
+    value_ss >> value;
+    const int id = FindVarID(name);
+    if (id < 0 || value_ss.fail() || (value_ss >> extra)) return false;
+
+    const std::string op = text.substr(op_start, op_end - op_start);
+    if (op == "<") test = [id, value](cHardware & hw) { return hw.GetVar(id).AsFloat() < value; };
+    else if (op == "<=") test = [id, value](cHardware & hw) { return hw.GetVar(id).AsFloat() <= value; };
+    else if (op == ">") test = [id, value](cHardware & hw) { return hw.GetVar(id).AsFloat() > value; };
+    else if (op == ">=") test = [id, value](cHardware & hw) { return hw.GetVar(id).AsFloat() >= value; };
+    else if (op == "==") test = [id, value](cHardware & hw) { return hw.GetVar(id).AsFloat() == value; };
+    else if (op == "!=") test = [id, value](cHardware & hw) { return hw.GetVar(id).AsFloat() != value; };
+    else return false;
+    return true;
+  }
   
 public:
-  VM_UI_base() : hardware(NULL), is_paused(true)
+  VM_UI_base() : hardware(NULL), is_paused(true), code_view_top(0), code_top(0)
+               , play_speed_id(1), play_pending(false), run_to_end(false)
+               , play_last_time(0.0), play_owed(0.0), play_batch(64)
   {
     doc << "<h1>Welcome to the TubeIC virtual machine</h1>"
         << "<p>Choose a Tube Intermediate Code file that you would like to load and run.</p>";
@@ -50,23 +159,28 @@ public:
     
     doc.AddButton([this](){DoRestart();}, "Restart", "but_restart")
       .Title("Restart program from beginning").SetWidth(80).Disabled(true);
+    doc.AddButton([this](){DoStepBack();}, "Back", "but_back")
+      .Title("Undo the most recently executed instruction").SetWidth(80).Disabled(true);
     doc.AddButton([this](){DoStep();}, "Step", "but_step")
       .Title("Execute a single instruction in the program").SetWidth(80).Disabled(true);
     doc.AddButton([this](){DoPlay();}, "Play", "but_play")
       .Title("Continuously execute instructions").SetWidth(80).Disabled(true);
     doc.AddButton([this](){DoEnd();}, "To End", "but_end")
       .Title("Execute entire program and display final state").SetWidth(80).Disabled(true);
+    doc.AddButton([this](){DoSpeed();}, SpeedLabel(), "but_speed")
+      .Title("Change how many instructions per second Play executes").SetWidth(100).Disabled(true);
     
     doc << "</p>";
     UI::Slate code_div("code_div");
     code_div.SetColor("black");
     code_div.SetPadding(5);
     code_div.SetFloat("left");
-    code_div.SetHeight(500);
+    code_div.SetHeight(code_view_height);
     code_div.SetOverflow("auto"); // Scolling!
     
-    UI::Table code_table(1,5,"code");
+    UI::Table code_table(1,6,"code");
     code_table.SetCSS("border-collapse", "collapse");
+    code_table.SetCSS("white-space", "nowrap");
     code_table.SetBackground(inst_bg);
     
     code_table.AddHeader(0,0, "Line");
@@ -74,6 +188,7 @@ public:
     code_table.AddHeader(0,2, "Arg 1");
     code_table.AddHeader(0,3, "Arg 2");
     code_table.AddHeader(0,4, "Arg 3");
+    code_table.AddHeader(0,5, "Arg 4");
 
     UI::Slate rt_column("rt_column");
     UI::Slate console("console");
@@ -84,6 +199,8 @@ public:
     console.SetSize(500, 200).SetFloat("left").SetPadding(5)
       .SetColor("white").SetBackground("black")
       .SetOverflow("auto").SetBorder("4px solid white");
+    console.SetCSS("white-space", "pre-wrap");
+    console.SetCSS("font-family", "monospace");
 
     var_div.SetSize(var_table_width,290).SetFloat("left").SetPadding(5)
       .SetColor("black").SetBackground("white")
@@ -104,96 +221,152 @@ public:
   }
   virtual ~VM_UI_base() { ; }
 
-  void UpdateCode() {
-    UI::Table code_table = doc.Table("code");
-    code_table.Freeze();  // Pause live updates until new data is in table.
-    
+  // Rebuild the list of code lines (labels and instructions).
+  void BuildCodeLines() {
     // Reorganize label_map to be sorted by position, NOT name
     std::multimap<int, std::string> position_map = emp::flip_map(hardware->GetLabelMap());
 
     // Be ready to step through position map to identify when we've hit a label!
     auto label_it = position_map.begin();
 
-    // Resize the table appropriately.
-    const int num_rows = hardware->GetNumInsts() + position_map.size() + 1;
-    code_table.Rows( num_rows );
+    const int num_insts = hardware->GetNumInsts();
+    code_lines.clear();
+    code_lines.reserve(num_insts + position_map.size());
+    line_labels.clear();
+    inst_rows.resize(num_insts);
+    for (int inst_id = 0; inst_id <= num_insts; inst_id++) {
+      // Labels go before the instruction they point to; any final labels go at the end.
+      while (label_it != position_map.end() && (inst_id == label_it->first || inst_id == num_insts)) {
+        code_lines.push_back(-1 - (int) line_labels.size());
+        line_labels.push_back(label_it->second);
+        label_it++;
+      }
+      if (inst_id == num_insts) break;
+      inst_rows[inst_id] = (int) code_lines.size();
+      code_lines.push_back(inst_id);
+    }
+  }
 
-    // Step through all of the instructions in the program
-    int cur_row = 1;
-    for (int inst_id = 0; inst_id < hardware->GetNumInsts(); inst_id++) {
-      // Clear the current row.
-      code_table.GetRow(cur_row).Clear();
-      code_table.GetRow(cur_row).SetBackground("white");
+  // Rebuild the code lines, then draw the window around the IP.
+  void UpdateCode() {
+    BuildCodeLines();
+    const int IP = hardware->GetNextIP();
+    ScrollCodeTo((IP >= 0 && IP < (int) inst_rows.size()) ? inst_rows[IP] - 3 : 0);
+  }
 
-      // Check if there is a label we need to print.
-      while (label_it != position_map.end() && inst_id == label_it->first) {
-        code_table.GetCell(cur_row, 0).SetColSpan(5) << label_it->second << ":";
-        label_it++;
-        cur_row++;
+  // Draw code lines [code_top, code_top + window) into the table, with spacer rows standing in
+  // for the lines above and below.
+  void DrawCodeWindow() {
+    UI::Table code_table = doc.Table("code");
+    code_table.Freeze();  // Pause live updates until new data is in table.
+
+    const int num_lines = (int) code_lines.size();
+    int window_rows = code_visible_rows + 2 * view_margin_rows;
+    if (code_top + window_rows > num_lines) window_rows = num_lines - code_top;
+    if (window_rows < 0) window_rows = 0;
+    code_table.Rows(window_rows + 3);
+
+    code_table.GetRow(1).Clear();
+    code_table.GetCell(1, 0).SetColSpan(6).SetCSS("height", AsPixels(code_top * row_height));
+
+    for (int row_id = 0; row_id < window_rows; row_id++) {
+      const int cur_row = row_id + 2;
+      const int line_id = code_top + row_id;
+      code_table.GetRow(cur_row).Clear().SetBackground("white");
+      code_table.GetRow(cur_row).SetCSS("height", AsPixels(row_height));
+
+      // Is this line a label?
+      if (code_lines[line_id] < 0) {
+        code_table.GetCell(cur_row, 0).SetColSpan(6) << line_labels[-1 - code_lines[line_id]] << ":";
+        continue;
       }
 
-      // Instruction
+      const int inst_id = code_lines[line_id];
       cInst_Base * inst = hardware->GetInst(inst_id);
 
-      // Make the current instruction (at the IP) a different color.
-      if (inst_id == hardware->GetIP()) {
-        code_table.GetRow(cur_row).SetBackground(IP_bg);
-      }
-        
+      // Make the current instruction (at the IP) and breakpoints different colors.
+      code_table.GetRow(cur_row).SetBackground(RowBackground(inst_id));
+
       // Update the information about the current instruction.
       code_table.GetCell(cur_row, 0) << inst_id;
       code_table.GetCell(cur_row, 1) << inst->GetName();
 
       // If there are arguments, update them as well.
-      for (int i = 0; i < 3; i++) {
+      for (int i = 0; i < 4; i++) {
         code_table.GetCell(cur_row, i+2) << inst->GetArgString(i);
       }
-
-      cur_row++;
     }
 
-    // See if there are any final labels to include
-    while (label_it != position_map.end()) {
-      code_table.GetCell(cur_row, 0).SetColSpan(5) << label_it->second << ":";
-      label_it++;
-      cur_row++;
-    }
+    const int below = num_lines - code_top - window_rows;
+    code_table.GetRow(window_rows + 2).Clear();
+    code_table.GetCell(window_rows + 2, 0).SetColSpan(6).SetCSS("height", AsPixels(below * row_height));
 
     code_table.Activate();
-    // code_table.Redraw();
+  }
 
-    // std::stringstream ss;
-    // ss << "Testing OK()" << std::endl;
-    // code_table.OK(ss, false);
-    // emp::Alert(ss.str());
+  // Scroll the code view so that line_id is at the top, redrawing the window around it.
+  void ScrollCodeTo(int line_id) {
+    const int max_top = (int) code_lines.size() - code_visible_rows;
+    if (line_id > max_top) line_id = max_top;
+    if (line_id < 0) line_id = 0;
+    code_view_top = line_id;
+    code_top = (line_id > view_margin_rows) ? line_id - view_margin_rows : 0;
+    DrawCodeWindow();
 
-    
-    // Where should we scroll to on the screen?
-    // Aim for top of scroll to be a few lines above IP.
+    // The header row sits above the first line.
+    EM_ASM_ARGS({
+        var code_obj = document.getElementById("code_div");
+        if (code_obj) code_obj.scrollTop = $0;
+    }, (code_view_top == 0) ? 0 : (code_view_top + 1) * row_height);
+  }
 
-    // float scroll_frac = ((float) (hardware->GetIP() - 3)) / (float) hardware->GetNumInsts();
-    // if (scroll_frac < 0.0) scroll_frac = 0.0;
+  // Called from the page when the user scrolls the code view.
+  void CodeScrolled(int scroll_top) {
+    int line_id = scroll_top / row_height - 1;
+    if (line_id < 0) line_id = 0;
+    code_view_top = line_id;
+
+    // Only redraw once the visible lines run outside of the window already drawn.
+    const int window_rows = code_visible_rows + 2 * view_margin_rows;
+    if (line_id >= code_top && line_id + code_visible_rows <= code_top + window_rows) return;
+    code_top = (line_id > view_margin_rows) ? line_id - view_margin_rows : 0;
+    DrawCodeWindow();
+  }
 
-    // EM_ASM_ARGS({
-    //     var code = Pointer_stringify($0);
-    //     var code_obj = document.getElementById("code");
-    //     code_obj.innerHTML = code;
-    //     code_obj.scrollTop = $1 * code_obj.scrollHeight;
-    //     var cycle_obj = document.getElementById("cycle_count");
-    //     cycle_obj.innerHTML = "&nbsp;&nbsp;&nbsp;Cycles Used = " + $2;
-    // }, ss.str().c_str(), scroll_frac, hardware->GetExeCount());
+  // Called from the page when the user scrolls the memory view, if there is one.
+  virtual void MemScrolled(int scroll_top) { (void) scroll_top; }
 
+  // Move the IP highlight between rows without rebuilding the code table.
+  // If the new IP has left the visible lines, scroll to keep it in view.
+  void UpdateIP(int old_IP) {
+    const int new_IP = hardware->GetNextIP();
+    if (old_IP == new_IP) return;
 
-  }
+    if (new_IP >= 0 && new_IP < (int) inst_rows.size()) {
+      const int line_id = inst_rows[new_IP];
+      if (line_id < code_view_top || line_id >= code_view_top + code_visible_rows) {
+        ScrollCodeTo(line_id - 3);
+        return;
+      }
+    }
 
+    UI::Table code_table = doc.Table("code");
+    const int window_rows = code_visible_rows + 2 * view_margin_rows;
+    if (old_IP >= 0 && old_IP < (int) inst_rows.size()) {
+      const int row_id = inst_rows[old_IP] - code_top;
+      if (row_id >= 0 && row_id < window_rows) code_table.GetRow(row_id + 2).SetBackground(RowBackground(old_IP));
+    }
+    if (new_IP >= 0 && new_IP < (int) inst_rows.size()) {
+      const int row_id = inst_rows[new_IP] - code_top;
+      if (row_id >= 0 && row_id < window_rows) code_table.GetRow(row_id + 2).SetBackground(IP_bg);
+    }
+  }
   
   void UpdateConsole() {
     UI::Slate console = doc.Slate("console");
 
     console.ClearChildren();
-    console << "<pre>"
-            << hardware->GetMessages()
-            << "</pre>";
+    console << hardware->GetMessages();
 
     // @CAO Make sure to scroll to console bottom!
     // console_obj.scrollTop = console_obj.scrollHeight;
@@ -201,19 +374,97 @@ public:
     console.Redraw();
   }
 
+  // Append only the output produced since position start.
+  void UpdateConsole(long long start) {
+    const std::string messages = hardware->GetMessages();
+    if (start >= (long long) messages.size()) return;
+
+    UI::Slate console = doc.Slate("console");
+    console << messages.substr(start);
+  }
+
   // The main different between hardware types is available variables
   virtual void UpdateVars() = 0;
+
+  // Update only the variables that changed; by default just redraw them all if any did.
+  virtual void UpdateVars(const cChangeSet & changes) {
+    if (!changes.Empty()) UpdateVars();
+  }
   
   void UpdateUI() { 
     UpdateCode();
     UpdateConsole();
     UpdateVars();
+    hardware->ClearChanges();
+  }
+
+  // Redraw only what the hardware reports as changed since the last update.
+  void UpdateChanges() {
+    const cChangeSet & changes = hardware->GetChanges();
+    UpdateIP(changes.old_IP);
+
+    // Too much changed to track (or the machine was reset); the code is unchanged, so only
+    // redraw the console and variables in full.
+    if (changes.full) {
+      UpdateConsole();
+      UpdateVars();
+    } else {
+      UpdateConsole(changes.output_start);
+      UpdateVars(changes);
+    }
+    hardware->ClearChanges();
+  }
+
+  // The program was edited in place; redraw it without scrolling away from the edit.
+  void CodeEdited() {
+    BuildCodeLines();
+    ScrollCodeTo(code_view_top);
+    UpdateConsole();
+    UpdateVars();
+    hardware->ClearChanges();
   }
 
   void SetupHardware(cHardware * _hw)
   {
     hardware = _hw;
+    hardware->TrackChanges(true);
     UpdateUI();
+
+    EM_ASM({
+        var code_obj = document.getElementById("code_div");
+        if (code_obj) code_obj.onscroll = function() { Module._CodeScrolled(code_obj.scrollTop); };
+
+        // Clicking an instruction toggles a breakpoint on it; shift-click asks for a condition.
+        if (code_obj) code_obj.onclick = function(e) {
+          var row = e.target.closest("tr");
+          if (!row || row.cells.length < 2) return;
+          var inst_id = parseInt(row.cells[0].textContent);
+          if (isNaN(inst_id)) return;
+          var condition = "";
+          if (e.shiftKey) {
+            condition = prompt("Stop at instruction " + inst_id + " only when (e.g. s3 > 10):", "");
+            if (condition === null) return;
+          }
+          Module.ccall('ToggleBreakpoint', null, ['number', 'string'], [inst_id, condition]);
+        };
+    });
+  }
+
+  // Set a breakpoint on an instruction (stopping only when condition holds, if there is one),
+  // or clear the breakpoint already there if no condition is given.
+  void ToggleBreakpoint(int inst_id, const std::string & condition) {
+    if (inst_id < 0 || inst_id >= hardware->GetNumInsts()) return;
+    if (condition.size() == 0) {
+      if (!hardware->ClearBreakpoint(inst_id)) hardware->SetBreakpoint(inst_id);
+    } else {
+      tBreakCondition test;
+      if (!ParseCondition(condition, test)) {
+        emp::Alert("Unable to understand breakpoint condition '", condition, "'.");
+        return;
+      }
+      hardware->SetBreakpoint(inst_id, test);
+    }
+    DrawCodeWindow();
   }
 
   void DoRestart() {
@@ -221,51 +472,111 @@ public:
     UpdateUI();
 
     is_paused = true;
+    run_to_end = false;
     doc.Button("but_play").Label("Play");
   }
 
   void DoStep() {
     hardware->RunStep();
-    UpdateUI();
+    UpdateChanges();
+  }
+
+  void DoStepBack() {
+    if (hardware->StepBack()) UpdateChanges();
   }
 
   void DoPlay() {
     is_paused = !is_paused;
+    run_to_end = false;
     if (is_paused) doc.Button("but_play").Label("Play");
     else {
       doc.Button("but_play").Label("Pause");
-      DoPlayStep();
+      StartPlay();
     }
   }
 
+  // Run to the end in time-budgeted frames, so the page stays responsive (and pausable) even
+  // if the program never halts.
   void DoEnd() {
-    hardware->Run();    
-    UpdateUI();
+    is_paused = false;
+    run_to_end = true;
+    doc.Button("but_play").Label("Pause");
+    StartPlay();
+  }
 
-    is_paused = true;
-    doc.Button("but_play").Label("Play");
+  void DoSpeed() {
+    play_speed_id = (play_speed_id + 1) % num_play_speeds;
+    play_owed = 0.0;
+    doc.Button("but_speed").Label(SpeedLabel());
+  }
+
+  void StartPlay() {
+    play_last_time = emscripten_get_now();
+    play_owed = 1.0;   // Start with an instruction right away.
+    if (!play_pending) DoPlayStep();
   }
 
+  // Execute one frame's worth of instructions, then redraw once.
   void DoPlayStep() {
+    play_pending = false;
+
     // If we've run off the end, automatically pause.
-    if (hardware->GetIP() >= hardware->GetNumInsts()) {
+    if (hardware->GetNextIP() >= hardware->GetNumInsts()) {
       is_paused = true;
+      run_to_end = false;
       doc.Button("but_play").Label("Play");
     }
-    if (is_paused == false) {
-      DoStep();
-      emp::DelayCall( [this](){DoPlayStep();}, 250 );
+    if (is_paused) return;
+
+    const int speed = run_to_end ? 0 : play_speeds[play_speed_id];
+    const double cur_time = emscripten_get_now();
+    if (speed == 0) RunForTime(frame_budget_ms, 1 << 30);
+    else {
+      // Owe instructions in proportion to the time passed, but never more than a second's worth.
+      play_owed += speed * (cur_time - play_last_time) / 1000.0;
+      if (play_owed > speed) play_owed = speed;
+      const int due = (int) play_owed;
+      if (due > 0) play_owed -= RunForTime(frame_budget_ms, due);
+    }
+    play_last_time = cur_time;
+
+    UpdateChanges();
+
+    // Reaching a breakpoint pauses play; playing again continues from there.
+    if (hardware->AtBreakpoint()) {
+      is_paused = true;
+      run_to_end = false;
+      doc.Button("but_play").Label("Play");
+      return;
     }
+
+    play_pending = true;
+    emp::DelayCall( [this](){DoPlayStep();}, (speed == 0) ? 0 : frame_delay_ms );
   }
 
 };
 
 
 class TubeIC_UI : public VM_UI_base{
+private:
+  std::map<int, std::pair<int,int> > var_cells;    // Table cell (row, col) showing each scalar.
+  std::map<int, std::pair<int,int> > array_cells;  // Table cell (row, col) showing each array.
+
+  void DrawArray(UI::Table & var_table, int id, const cArray & array) {
+    var_table << "a" << id << " = [ ";
+    for (int i = 0; i < array.GetSize(); i++) {
+      if (i>0) var_table << ", ";
+      var_table << array.GetIndex(i);
+    }
+    var_table << "]";
+  }
+
 public:
   TubeIC_UI() { ; }
   ~TubeIC_UI() { ; }
 
+  using VM_UI_base::UpdateVars;
+
   void UpdateVars() {
     const std::map<int, cVar> & var_map = hardware->GetVarMap();
     const std::map<int, cArray> & array_map = hardware->GetArrayMap();
@@ -287,6 +598,8 @@ public:
     
     UI::Table var_table = doc.Table("var_table");
     var_table.ClearRows();
+    var_cells.clear();
+    array_cells.clear();
     var_table.Resize(total_rows, var_table_col_count);
     
     // Setup the header for scalars
@@ -301,6 +614,7 @@ public:
       if (cur_col == var_table_col_count) { cur_row++; cur_col = 0; }
       var_table.GetCell(cur_row, cur_col).SetWidth(col_width)
         << "s" << var_it->first << " = " << var_it->second.AsInt();
+      var_cells[var_it->first] = std::make_pair(cur_row, cur_col);
       cur_col++;
     }
 
@@ -325,14 +639,9 @@ public:
     cur_col = 0;
     for (auto var_it = array_map.begin(); var_it != array_map.end(); var_it++) {
       if (cur_col == var_table_col_count) { cur_row++; cur_col = 0; }
-      var_table.GetCell(cur_row, cur_col).SetWidth(col_width)
-        << "s" << var_it->first << " = [ ";
-      for (int i = 0; i < var_it->second.GetSize(); i++) {
-        if (i>0) var_table << ", ";
-        var_table << var_it->second.GetIndex(i);
-      }
-
-      var_table << "]";
+      var_table.GetCell(cur_row, cur_col).SetWidth(col_width);
+      DrawArray(var_table, var_it->first, var_it->second);
+      array_cells[var_it->first] = std::make_pair(cur_row, cur_col);
       cur_col++;
     }
     cur_row++;
@@ -340,13 +649,40 @@ public:
     var_table.Redraw();
   }
 
-  
+  // Rewrite only the cells of changed variables; a variable without a cell yet needs a full redraw.
+  void UpdateVars(const cChangeSet & changes) {
+    const std::map<int, cVar> & var_map = hardware->GetVarMap();
+    const std::map<int, cArray> & array_map = hardware->GetArrayMap();
+    const int col_width = var_table_width / var_table_col_count;
+
+    for (auto id_it = changes.vars.begin(); id_it != changes.vars.end(); id_it++) {
+      if (var_cells.count(*id_it) == 0 || var_map.count(*id_it) == 0) { UpdateVars(); return; }
+    }
+    for (auto id_it = changes.arrays.begin(); id_it != changes.arrays.end(); id_it++) {
+      if (array_cells.count(*id_it) == 0 || array_map.count(*id_it) == 0) { UpdateVars(); return; }
+    }
+
+    UI::Table var_table = doc.Table("var_table");
+    for (auto id_it = changes.vars.begin(); id_it != changes.vars.end(); id_it++) {
+      const std::pair<int,int> & cell = var_cells[*id_it];
+      var_table.GetCell(cell.first, cell.second).Clear().SetWidth(col_width)
+        << "s" << *id_it << " = " << var_map.find(*id_it)->second.AsInt();
+    }
+    for (auto id_it = changes.arrays.begin(); id_it != changes.arrays.end(); id_it++) {
+      const std::pair<int,int> & cell = array_cells[*id_it];
+      var_table.GetCell(cell.first, cell.second).Clear().SetWidth(col_width);
+      DrawArray(var_table, *id_it, array_map.find(*id_it)->second);
+    }
+  }
 };
 
 
 class tubecode_UI : public VM_UI_base{
+private:
+  int mem_view_top;   // First memory row scrolled into view.
+
 public:
-  tubecode_UI() { ; }
+  tubecode_UI() : mem_view_top(0) { ; }
   ~tubecode_UI() { ; }
 
   void UpdateVars() {
@@ -379,49 +715,79 @@ public:
       var_count++;
     }
     
-    // Print the state of the memory into the table.
-    const std::vector<float> & mem_array = hardware->GetMemArray();
-    const int max_mem = hardware->GetMaxMemSet();
-    const int row_size = 10;
+    // Print the state of the memory into its own scrolling view; only the rows around the visible
+    // ones are drawn, with spacer rows standing in for the rest.
+    const cMemory & mem_array = hardware->GetMemArray();
+    const int num_rows = hardware->GetMaxMemSet() / mem_row_size + 1;
+    int first_row = mem_view_top - view_margin_rows;
+    if (first_row < 0) first_row = 0;
+    int last_row = mem_view_top + mem_visible_rows + view_margin_rows;
+    if (last_row > num_rows) last_row = num_rows;
 
     ss << "</table><table width=" << table_width << "px>"
-       << "<tr style=\"background-color:#CCCCFF\"><th colspan=" << (row_size+1)
-       << ">Memory</th></tr>";
-
-    bool skipping = false;
-    for (int i = 0; i <= max_mem; i += row_size) {
-      // See if this entire row is just zeros
-      bool all_zero = true;
-      for (int j = i; j < i+row_size; j++) {
-        if (mem_array[j] != 0) { all_zero = false; break; }
-      }
-
-      // If there is information on this row (or its the first row) print it!
-      if (all_zero == false || i == 0) {
-        ss << "<tr><th>" << i;
-        for (int j = i; j < i+row_size; j++) {
-          ss << "<td>" << mem_array[j];
-        }
-        ss << "</tr>";
-        skipping = false;
-      }
-
-      // If this row is being skipped, put a ... unles we already have...
-      else if (skipping == false) {
-        ss << "<tr><th colspan=" << row_size+1 << ">...</tr>";
-        skipping = true;
+       << "<tr style=\"background-color:#CCCCFF\"><th colspan=" << (mem_row_size+1)
+       << ">Memory</th></tr></table>"
+       << "<div id=\"mem_view\" style=\"height:" << mem_view_height << "px;overflow:auto\">"
+       << "<table width=" << table_width << "px style=\"white-space:nowrap\">"
+       << "<tr style=\"height:" << (first_row * row_height) << "px\"><td colspan="
+       << (mem_row_size+1) << "></tr>";
+
+    for (int row_id = first_row; row_id < last_row; row_id++) {
+      const int i = row_id * mem_row_size;
+      ss << "<tr style=\"height:" << row_height << "px\"><th>" << i;
+      for (int j = i; j < i+mem_row_size; j++) {
+        ss << "<td>" << mem_array[j];
       }
+      ss << "</tr>";
     }
 
-    ss << "</table>";
+    ss << "<tr style=\"height:" << ((num_rows - last_row) * row_height) << "px\"><td colspan="
+       << (mem_row_size+1) << "></tr></table></div>";
 
     EM_ASM_ARGS({
         var var_info = Pointer_stringify($0);
         document.getElementById("vars").innerHTML = var_info;
-    }, ss.str().c_str());
+        var mem_obj = document.getElementById("mem_view");
+        if (mem_obj) {
+          mem_obj.scrollTop = $1;
+          mem_obj.onscroll = function() { Module._MemScrolled(mem_obj.scrollTop); };
+        }
+    }, ss.str().c_str(), mem_view_top * row_height);
   }
 
-  
+  // Memory writes scroll the view to show them (if none are already visible).
+  void UpdateVars(const cChangeSet & changes) {
+    if (changes.Empty()) return;
+
+    bool visible = changes.mem.empty();
+    for (auto pos_it = changes.mem.begin(); pos_it != changes.mem.end() && !visible; pos_it++) {
+      const int row_id = *pos_it / mem_row_size;
+      visible = (row_id >= mem_view_top && row_id < mem_view_top + mem_visible_rows);
+    }
+    if (!visible) {
+      mem_view_top = *changes.mem.begin() / mem_row_size - 3;
+      if (mem_view_top < 0) mem_view_top = 0;
+    }
+
+    UpdateVars();
+  }
+
+  // Registers are named regA, regB, ...
+  int FindVarID(const std::string & name) const {
+    if (name.size() != 4 || name.compare(0, 3, "reg") != 0 || name[3] < 'A' || name[3] > 'Z') return -1;
+    return name[3] - 'A';
+  }
+
+  void MemScrolled(int scroll_top) {
+    const int row_id = scroll_top / row_height;
+    if (row_id == mem_view_top) return;
+    const bool redraw = (row_id < mem_view_top - view_margin_rows / 2 ||
+                         row_id > mem_view_top + view_margin_rows / 2);
+    if (redraw) {
+      mem_view_top = row_id;
+      UpdateVars();
+    }
+  }
 };
 
 